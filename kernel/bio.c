@@ -150,4 +150,23 @@ bunpin(struct buf *b) {
   release(&bcache.lock);
 }
 
+// Is any of the n blocks starting at blockno in the cache,
+// and so perhaps newer than what is on disk?
+int
+bcached(uint dev, uint blockno, int n)
+{
+  struct buf *b;
+  int found = 0;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno - blockno < n && (b->valid || b->refcnt > 0)){
+      found = 1;
+      break;
+    }
+  }
+  release(&bcache.lock);
+  return found;
+}
+
 
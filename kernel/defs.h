@@ -2,10 +2,12 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct logstat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct iovec;
 struct stat;
 struct superblock;
 
@@ -16,6 +18,7 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bcached(uint, uint, int);
 
 // console.c
 void            consoleinit(void);
@@ -33,19 +36,30 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesync(struct file*);
+int             filepread(struct file*, uint64, int n, uint off);
+int             filepwrite(struct file*, uint64, int n, uint off);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filesplice(struct file*, struct file*, int);
 
 // fs.c
 void            fsinit(int);
+void            dcacheforget(struct inode*, char*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+int             isdirempty(struct inode*);
+struct inode*   ialloc(uint, short, struct inode*);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlock_shared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            iflush(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -69,17 +83,27 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             logopmax(void);
+void            logstat(struct logstat*);
+void            logsync(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipebeginwrite(struct pipe*, struct iovec*, int);
+void            pipeendwrite(struct pipe*, int);
+int             pipebeginread(struct pipe*, struct iovec*, int, int);
+void            pipeendread(struct pipe*, int);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
+int             prgetc(void);
 
 // proc.c
 int             cpuid(void);
@@ -123,12 +147,15 @@ void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
+void            lockdump(void);
 void            push_off(void);
 void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
+void            releasesleep_shared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -159,7 +186,8 @@ void            usertrapret(void);
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+void            uartwrite(char*, int);
+void            uartkick(void);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -177,6 +205,7 @@ void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
+uint64          useraddr(pagetable_t, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -190,6 +219,11 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf **, int, int);
+void            virtio_disk_kick(void);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_direct(uint, uint64*, int, int);
+void            virtio_disk_flush(void);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
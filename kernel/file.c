@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "iovec.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -22,7 +23,11 @@ struct {
 void
 fileinit(void)
 {
+  struct file *f;
+
   initlock(&ftable.lock, "ftable");
+  for(f = ftable.file; f < ftable.file + NFILE; f++)
+    initsleeplock(&f->offlock, "file");
 }
 
 // Allocate a file structure.
@@ -91,9 +96,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilock_shared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlock_shared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -106,27 +111,133 @@ filestat(struct file *f, uint64 addr)
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1);
+}
+
+// Read from file f into the niov user buffers described
+// by iov, in order, stopping at the first short read.
+int
+filereadv(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r = 0, tot = 0;
 
   if(f->readable == 0)
     return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    // a second read could block though data has
+    // come in, so fill just the first buffer.
+    for(i = 0; i < niov && iov[i].len == 0; i++)
+      ;
+    if(i == niov)
+      return 0;
+    if(f->type == FD_PIPE)
+      return piperead(f->pipe, (uint64)iov[i].base, iov[i].len);
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    return devsw[f->major].read(1, (uint64)iov[i].base, iov[i].len);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    // readers of the inode share its lock, so processes
+    // sharing f take turns with f->off under f->offlock.
+    // writers hold the inode lock exclusive, which is
+    // enough to keep them off f->off.
+    acquiresleep(&f->offlock);
+    ilock_shared(f->ip);
+    for(i = 0; i < niov; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].base, f->off, iov[i].len)) < 0)
+        break;
       f->off += r;
-    iunlock(f->ip);
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    iunlock_shared(f->ip);
+    releasesleep(&f->offlock);
   } else {
     panic("fileread");
   }
 
-  return r;
+  return r < 0 ? -1 : tot;
+}
+
+// Write the niov buffers described by iov, one after the
+// other, to inode ip at offset *poff, advancing *poff as
+// the data goes in. They go in the same transactions and
+// under the same lock, as if they were one buffer.
+// If user_src==1, the buffers are at user virtual
+// addresses; otherwise, at kernel addresses.
+static int
+inodewrite(struct inode *ip, int user_src, struct iovec *iov, int niov, uint *poff)
+{
+  int n, r = 0, m, m1, v, vo;
+  uint64 tot;
+
+  tot = 0;
+  for(v = 0; v < niov; v++)
+    tot += iov[v].len;
+  if(tot > 0x7fffffff)
+    return -1;
+  n = tot;
+
+  // write up to as many blocks at a time as one system
+  // call may reserve in the log, and reserve only what
+  // each chunk needs: its blocks plus room for the
+  // i-node, indirect blocks, allocation bitmap blocks,
+  // 2 blocks of slop for non-aligned writes, and
+  // writing out delayed appends (see iflush()).
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int slack = 1+4+2+2+NDELAY+2;
+  int max = (logopmax() - slack) * BSIZE;
+  if(max < BSIZE)
+    max = BSIZE;  // a tiny log: one block at a time
+  int i = 0;
+  v = vo = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+    int nop = (n1 + BSIZE - 1) / BSIZE + slack;
+    if(nop < MAXOPBLOCKS)
+      nop = MAXOPBLOCKS;
+    if(nop > logopmax())
+      nop = logopmax();
+
+    begin_opn(nop);
+    ilock(ip);
+    // the pieces of the buffers in this chunk are
+    // consecutive in the file, so they need no more
+    // log space than one buffer of the same size.
+    for(m = 0; m < n1; m += r){
+      while(vo == iov[v].len){
+        v++;
+        vo = 0;
+      }
+      r = iov[v].len - vo;
+      if(r > n1 - m)
+        r = n1 - m;
+      if((m1 = writei(ip, user_src, (uint64)iov[v].base + vo, *poff, r)) != r){
+        // error from writei; keep the offset past what it did write.
+        if(m1 > 0)
+          *poff += m1;
+        r = -1;
+        break;
+      }
+      *poff += r;
+      vo += r;
+    }
+    iunlock(ip);
+    end_opn(nop);
+
+    if(r < 0)
+      break;
+    i += n1;
+  }
+  return i == n ? n : -1;
 }
 
 // Write to file f.
@@ -134,45 +245,39 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filewritev(f, &iov, 1);
+}
+
+// Write the niov user buffers described by iov to file f.
+int
+filewritev(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, ret = 0;
 
   if(f->writable == 0)
     return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
+    for(i = 0; i < niov; i++){
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, (uint64)iov[i].base, iov[i].len);
+      else
+        r = devsw[f->major].write(1, (uint64)iov[i].base, iov[i].len);
+      if(r < 0)
+        return ret > 0 ? ret : -1;
+      ret += r;
+      if(r < iov[i].len)
         break;
-      }
-      i += r;
     }
-    ret = (i == n ? n : -1);
+  } else if(f->type == FD_INODE){
+    ret = inodewrite(f->ip, 1, iov, niov, &f->off);
   } else {
     panic("filewrite");
   }
@@ -180,3 +285,110 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f at offset off, leaving f->off alone.
+// addr is a user virtual address.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+
+  // no f->offlock: nothing here touches f->off, so
+  // processes sharing f read side by side.
+  ilock_shared(f->ip);
+  r = readi(f->ip, 1, addr, off, n);
+  iunlock_shared(f->ip);
+  return r;
+}
+
+// Write to file f at offset off, leaving f->off alone.
+// addr is a user virtual address.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return inodewrite(f->ip, 1, &iov, 1, &off);
+}
+
+// Write f's delayed data out, and wait until it
+// and everything else written so far is on disk.
+int
+filesync(struct file *f)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  begin_op();
+  ilock(f->ip);
+  iflush(f->ip);
+  iunlock(f->ip);
+  end_op();
+  logsync();
+  return 0;
+}
+
+// Move up to n bytes from file fin to file fout, one of which
+// is a pipe and the other an inode, without copying through
+// user memory: readi() and writei() work straight on the
+// pipe's buffer, so each byte is copied once, between it and
+// the buffer cache. Both files' offsets advance.
+// Return the number of bytes moved, or -1.
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  struct iovec iov[NPIPESEG+1];
+  int i, k, r, m, tot;
+
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+
+  tot = 0;
+  if(fin->type == FD_INODE && fout->type == FD_PIPE){
+    while(tot < n){
+      if((k = pipebeginwrite(fout->pipe, iov, n - tot)) < 0)
+        return tot > 0 ? tot : -1;
+      m = 0;
+      acquiresleep(&fin->offlock);
+      ilock_shared(fin->ip);
+      for(i = 0; i < k; i++){
+        if((r = readi(fin->ip, 0, (uint64)iov[i].base, fin->off, iov[i].len)) <= 0)
+          break;
+        fin->off += r;
+        m += r;
+        if(r < iov[i].len)
+          break;
+      }
+      iunlock_shared(fin->ip);
+      releasesleep(&fin->offlock);
+      pipeendwrite(fout->pipe, m);
+      tot += m;
+      if(i < k)  // end of file
+        break;
+    }
+  } else if(fin->type == FD_PIPE && fout->type == FD_INODE){
+    while(tot < n){
+      // wait for data only if there has been none yet.
+      if((k = pipebeginread(fin->pipe, iov, n - tot, tot == 0)) <= 0)
+        return tot > 0 || k == 0 ? tot : -1;
+      m = 0;
+      for(i = 0; i < k; i++)
+        m += iov[i].len;
+      if(inodewrite(fout->ip, 0, iov, k, &fout->off) != m){
+        pipeendread(fin->pipe, 0);
+        return tot > 0 ? tot : -1;
+      }
+      pipeendread(fin->pipe, m);
+      tot += m;
+    }
+  } else {
+    return -1;
+  }
+  return tot;
+}
@@ -6,6 +6,7 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  struct sleeplock offlock; // FD_INODE, serializes reads through off
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +19,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // itable hash chain
+  struct inode *lprev; // itable LRU list, if ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +30,11 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  uint goal;          // where to allocate the next block (not on disk)
+  char *dbuf;         // appended data not yet in blocks, or 0
+  uint dstart;        // file offset of dbuf[0], a multiple of BSIZE
+  uint dsize;         // size on disk, while there is a dbuf
 };
 
 // map major device number to device functions.
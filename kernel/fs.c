@@ -26,6 +26,40 @@
 // only one device
 struct superblock sb; 
 
+// In-memory state of each allocation group. The free counts
+// let allocators pass over full groups without reading their
+// bit maps, and creates in different groups use different bit
+// map blocks, so they do not wait for each other.
+struct {
+  struct spinlock lock;
+  uint nfree;       // free data blocks
+  uint nifree;      // free inodes
+  uint rover;       // where new files should start looking for room
+} group[NGROUP];
+
+// Number of blocks in group g.
+static uint
+gsize(uint g)
+{
+  return min(sb.groupsize, sb.size - GSTART(g, sb));
+}
+
+// Count the clear bits among the first n bits of bit map block bno.
+static uint
+bcount(int dev, uint bno, uint n)
+{
+  struct buf *bp;
+  uint i, c;
+
+  bp = bread(dev, bno);
+  c = 0;
+  for(i = 0; i < n; i++)
+    if((bp->data[i/8] & (1 << (i % 8))) == 0)
+      c++;
+  brelse(bp);
+  return c;
+}
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -40,10 +74,19 @@ readsb(int dev, struct superblock *sb)
 // Init fs
 void
 fsinit(int dev) {
+  uint g;
+
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.ngroups > NGROUP)
+    panic("fsinit: too many groups");
   initlog(dev, &sb);
+  for(g = 0; g < sb.ngroups; g++){
+    initlock(&group[g].lock, "group");
+    group[g].nfree = bcount(dev, BBLOCK(GSTART(g, sb), sb), gsize(g));
+    group[g].nifree = bcount(dev, IBMAP(g, sb), sb.ipg);
+  }
 }
 
 // Zero a block.
@@ -60,29 +103,109 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Find want clear bits in a row among bits [from, n) of
+// bitmap block data, skipping 64 bits at a time where
+// they are all set or all clear.
+// Return the index of the first bit of the run, or -1.
+static int
+bfind(uchar *data, int from, int n, int want)
+{
+  uint64 *w = (uint64*)data;
+  int bi, run;
+
+  run = 0;
+  for(bi = from; bi < n; bi++){
+    if(bi % 64 == 0 && bi + 64 <= n){
+      if(w[bi/64] == ~0UL){
+        run = 0;
+        bi += 63;
+        continue;
+      }
+      if(w[bi/64] == 0){
+        run += 64;
+        if(run >= want)
+          return bi + 64 - run;
+        bi += 63;
+        continue;
+      }
+    }
+    if(data[bi/8] & (1 << (bi % 8)))
+      run = 0;
+    else if(++run == want)
+      return bi - want + 1;
+  }
+  return -1;
+}
+
+// Look for want free blocks in a row among blocks [from, to)
+// of group g, and mark the first of them in use.
+// Return its block number, or 0 if there is no such run.
 static uint
-balloc(uint dev)
+gscan(uint dev, uint g, uint from, uint to, int want)
 {
-  int b, bi, m;
+  uint start, n;
+  int bi;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  acquire(&group[g].lock);
+  n = group[g].nfree;
+  release(&group[g].lock);
+  if(n < want || from >= to)
+    return 0;
+
+  start = GSTART(g, sb);
+  bp = bread(dev, BBLOCK(start, sb));
+  bi = bfind(bp->data, from - start, to - start, want);
+  if(bi >= 0){
+    bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+    log_write(bp);
+  }
+  brelse(bp);
+  if(bi < 0)
+    return 0;
+
+  acquire(&group[g].lock);
+  group[g].nfree--;
+  if(want > 1)
+    group[g].rover = start + bi + want;
+  release(&group[g].lock);
+  return start + bi;
+}
+
+// Allocate a zeroed disk block, preferably goal.
+// Failing that, take the first block of a run of want
+// free blocks at or after goal, so that a file growing
+// from there can keep going sequentially, trying goal's
+// group before the ones after it; if there is no such run
+// anywhere, take any free block.
+static uint
+balloc(uint dev, uint goal, int want)
+{
+  uint b, g, i, gi;
+
+  if(goal < sb.groupstart || goal >= sb.size)
+    goal = sb.groupstart;
+  g = BGROUP(goal, sb);
+  if((b = gscan(dev, g, goal, goal + 1, 1)) != 0)
+    goto found;
+  for(;;){
+    for(i = 0; i < sb.ngroups; i++){
+      gi = (g + i) % sb.ngroups;
+      b = gscan(dev, gi, i == 0 ? goal : GSTART(gi, sb),
+                GSTART(gi, sb) + gsize(gi), want);
+      if(b)
+        goto found;
     }
-    brelse(bp);
+    if((b = gscan(dev, g, GSTART(g, sb), goal, want)) != 0)
+      goto found;
+    if(want == 1)
+      panic("balloc: out of blocks");
+    want = 1;
   }
-  panic("balloc: out of blocks");
+
+found:
+  bzero(dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -91,15 +214,21 @@ bfree(int dev, uint b)
 {
   struct buf *bp;
   int bi, m;
+  uint g;
 
+  g = BGROUP(b, sb);
   bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
+  bi = b - GSTART(g, sb);
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&group[g].lock);
+  group[g].nfree++;
+  release(&group[g].lock);
 }
 
 // Inodes.
@@ -117,14 +246,15 @@ bfree(int dev, uint b)
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The in-memory
 // inodes include book-keeping information that is
-// not stored on disk: ip->ref and ip->valid.
+// not stored on disk: ip->ref, ip->valid, and ip->goal.
 //
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
 // rest of the file system code.
 //
 // * Allocation: an inode is allocated if its type (on disk)
-//   is non-zero. ialloc() allocates, and iput() frees if
+//   is non-zero, and its bit in its group's inode bit map
+//   is set. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
@@ -132,7 +262,11 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. A free entry stays in the table, on
+//   a least-recently-used list, so that iget() can find
+//   it again until the entry is recycled. iget() recycles
+//   the least recently used free entry, and carves more
+//   entries out of a page from kalloc() if none is free.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -165,55 +299,195 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or the hash chains and LRU list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, and the list links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  // free entries, least recently used first.
+  // lru.lnext is the oldest.
+  struct inode lru;
+  int n;  // number of entries
 } itable;
 
+static void dcacheinit(void);
+static void dcachepurge(uint, uint);
+
+// Take ip off the list of free entries.
+// Caller must hold itable.lock.
+static void
+lruremove(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+}
+
+// Put ip on the list of free entries, as the most
+// recently used, or to be recycled first if old.
+// Caller must hold itable.lock.
+static void
+lruinsert(struct inode *ip, int old)
+{
+  struct inode *prev;
+
+  prev = old ? &itable.lru : itable.lru.lprev;
+  ip->lnext = prev->lnext;
+  ip->lprev = prev;
+  prev->lnext->lprev = ip;
+  prev->lnext = ip;
+}
+
+// Take ip off its hash chain, if it is on one.
+// Caller must hold itable.lock.
+static void
+ihremove(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->next){
+    if(*pp == ip){
+      *pp = ip->next;
+      break;
+    }
+  }
+}
+
+// Add a page's worth of free entries to the table.
+// Caller must hold itable.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *p;
+  int i;
+
+  if((p = kalloc()) == 0)
+    return -1;
+  memset(p, 0, PGSIZE);
+  for(i = 0; i < PGSIZE / sizeof(*ip); i++){
+    ip = (struct inode*)p + i;
+    initsleeplock(&ip->lock, "inode");
+    lruinsert(ip, 1);
+    itable.n++;
+  }
+  return 0;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.lru.lnext = itable.lru.lprev = &itable.lru;
+  acquire(&itable.lock);
+  while(itable.n < NINODE)
+    if(igrow() < 0)
+      panic("iinit");
+  release(&itable.lock);
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate an inode on device dev.
+// Pick the group in which to start looking for a free inode
+// for a new inode of type type in directory dp: dp's own group
+// for files, to keep them near their directory, and the group
+// with the most free inodes for directories, to spread them out.
+static uint
+igroup(struct inode *dp, short type)
+{
+  uint g, best, n, most;
+
+  best = IGROUP(dp->inum, sb);
+  if(type != T_DIR)
+    return best;
+  most = 0;
+  for(g = 0; g < sb.ngroups; g++){
+    acquire(&group[g].lock);
+    n = group[g].nifree;
+    release(&group[g].lock);
+    if(n > most){
+      most = n;
+      best = g;
+    }
+  }
+  return best;
+}
+
+// Allocate an inode on device dev, for directory dp.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, struct inode *dp)
 {
-  int inum;
+  uint g, i, inum, n;
+  int bi;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
+  g = igroup(dp, type);
+  for(i = 0; i < sb.ngroups; i++, g = (g + 1) % sb.ngroups){
+    acquire(&group[g].lock);
+    n = group[g].nifree;
+    release(&group[g].lock);
+    if(n == 0)
+      continue;
+
+    bp = bread(dev, IBMAP(g, sb));
+    if((bi = bfind(bp->data, 0, sb.ipg, 1)) < 0){
       brelse(bp);
-      return iget(dev, inum);
+      continue;
     }
+    bp->data[bi/8] |= 1 << (bi % 8);
+    log_write(bp);
+    brelse(bp);
+
+    acquire(&group[g].lock);
+    group[g].nifree--;
+    release(&group[g].lock);
+
+    inum = g * sb.ipg + bi;
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0)
+      panic("ialloc: inode in use");
+    memset(dip, 0, sizeof(*dip));
+    dip->type = type;
+    log_write(bp);   // mark it allocated on the disk
     brelse(bp);
+    return iget(dev, inum);
   }
   panic("ialloc: no inodes");
 }
 
+// Mark inode inum free in its group's inode bit map.
+static void
+ifree(uint dev, uint inum)
+{
+  struct buf *bp;
+  uint g, bi;
+
+  g = IGROUP(inum, sb);
+  bi = inum % sb.ipg;
+  bp = bread(dev, IBMAP(g, sb));
+  if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+    panic("freeing free inode");
+  bp->data[bi/8] &= ~(1 << (bi % 8));
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&group[g].lock);
+  group[g].nifree++;
+  release(&group[g].lock);
+}
+
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk.
@@ -230,7 +504,7 @@ iupdate(struct inode *ip)
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  dip->size = ip->dbuf ? ip->dsize : ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -242,31 +516,33 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Recycle an inode entry.
-  if(empty == 0)
+  if(itable.lru.lnext == &itable.lru && igrow() < 0)
     panic("iget: no inodes");
 
-  ip = empty;
+  ip = itable.lru.lnext;
+  lruremove(ip);
+  ihremove(ip);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -306,12 +582,31 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->goal = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
+// Lock the given inode shared, for code that only reads it
+// (readi, dirlookup, stati): any number of processes may
+// hold it shared at once, but then no one holds it exclusive.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  // reading it in from disk needs the exclusive lock.
+  // it stays valid while we hold a reference.
+  if(ip->valid == 0){
+    ilock(ip);
+    iunlock(ip);
+  }
+  acquiresleep_shared(&ip->lock);
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -322,6 +617,16 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Unlock an inode locked with ilock_shared().
+void
+iunlock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlock_shared");
+
+  releasesleep_shared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
 // be recycled.
@@ -334,6 +639,15 @@ iput(struct inode *ip)
 {
   acquire(&itable.lock);
 
+  if(ip->ref == 1 && ip->valid && ip->dbuf && ip->nlink > 0){
+    // last reference to a file with delayed data: write it out.
+    acquiresleep(&ip->lock);
+    release(&itable.lock);
+    iflush(ip);
+    releasesleep(&ip->lock);
+    acquire(&itable.lock);
+  }
+
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
@@ -344,8 +658,11 @@ iput(struct inode *ip)
     release(&itable.lock);
 
     itrunc(ip);
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
+    ifree(ip->dev, ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -354,6 +671,8 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0)
+    lruinsert(ip, !ip->valid);
   release(&itable.lock);
 }
 
@@ -370,48 +689,146 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are listed in the NINDIRECT blocks that are listed
+// in block ip->addrs[NDIRECT+1].
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Count how many of the n block numbers starting at a[i]
+// are consecutive.
+static uint
+countrun(uint *a, uint i, uint n)
+{
+  uint k;
+
+  for(k = 1; i + k < n && a[i+k] == a[i] + k; k++)
+    ;
+  return k;
+}
+
+// Allocate a block for ip's content, right after prev (the
+// file's previous block, or 0) if possible, else where ip's
+// last allocation left off, so a file's blocks stay together.
+static uint
+iballoc(struct inode *ip, uint prev)
+{
+  uint b, g, goal;
+
+  goal = prev ? prev + 1 : ip->goal;
+  if(goal == 0){
+    // Start near the inode, in its group.
+    g = IGROUP(ip->inum, sb);
+    acquire(&group[g].lock);
+    goal = group[g].rover;
+    release(&group[g].lock);
+    if(goal == 0)
+      goal = GSTART(g, sb);
+  }
+  b = balloc(ip->dev, goal, ip->type == T_FILE ? PREALLOC : 1);
+  ip->goal = b + 1;
+  return b;
+}
+
+// Return entry i of ip's indirect block addr, allocating
+// a block for the entry if it is empty and alloc is set.
+// If run != 0, set *run as for bmap().
 static uint
-bmap(struct inode *ip, uint bn)
+bindirect(struct inode *ip, uint addr, uint i, uint *run, int alloc)
 {
-  uint addr, *a;
+  uint *a;
   struct buf *bp;
 
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0 && alloc){
+    a[i] = addr = iballoc(ip, i > 0 ? a[i-1] : 0);
+    log_write(bp);
+  }
+  if(run && addr)
+    *run = countrun(a, i, NINDIRECT);
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one if alloc
+// is set, and otherwise returns 0 (a hole).
+// If run != 0, also set *run to the number of file blocks,
+// starting at bn, that are at consecutive disk addresses
+// and listed in the same place as bn, so that callers can
+// go through a contiguous run with one lookup.
+static uint
+bmap(struct inode *ip, uint bn, uint *run, int alloc)
+{
+  uint addr;
+
+  if(run)
+    *run = 1;
+
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0 && alloc)
+      ip->addrs[bn] = addr = iballoc(ip, bn > 0 ? ip->addrs[bn-1] : 0);
+    if(run && addr)
+      *run = countrun(ip->addrs, bn, NDIRECT);
     return addr;
   }
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+    if((addr = ip->addrs[NDIRECT]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT] = addr = iballoc(ip, 0);
     }
-    brelse(bp);
-    return addr;
+    return bindirect(ip, addr, bn, run, alloc);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load doubly-indirect block, then the indirect
+    // block it lists, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr = iballoc(ip, 0);
+    }
+    if((addr = bindirect(ip, addr, bn / NINDIRECT, 0, alloc)) == 0)
+      return 0;
+    return bindirect(ip, addr, bn % NINDIRECT, run, alloc);
   }
 
   panic("bmap: out of range");
 }
 
+// Free the blocks listed in indirect block addr, and addr itself.
+// If depth > 1, the listed blocks are themselves indirect blocks.
+static void
+bfreeindirect(uint dev, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j]){
+      if(depth > 1)
+        bfreeindirect(dev, a[j], depth - 1);
+      else
+        bfree(dev, a[j]);
+    }
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -421,21 +838,92 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeindirect(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bfreeindirect(ip->dev, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  if(ip->dbuf){
+    kfree(ip->dbuf);
+    ip->dbuf = 0;
+  }
+
   ip->size = 0;
   iupdate(ip);
 }
 
+// Delayed appends.
+//
+// Small appends to a file are collected in a page, ip->dbuf,
+// holding the file from block-aligned offset ip->dstart up to
+// ip->size, instead of going to blocks and the log right away.
+// The blocks are allocated, together, and written through the
+// log only when the page fills up, some other write comes
+// along, the last reference goes away, or fsync() asks. Until
+// then the inode on disk keeps its old size, ip->dsize.
+
+// Write ip's delayed data to its blocks.
+// Caller must hold ip->lock and be in a transaction.
+void
+iflush(struct inode *ip)
+{
+  char *p;
+  uint off, m;
+  struct buf *bp;
+
+  if((p = ip->dbuf) == 0)
+    return;
+  ip->dbuf = 0;
+  for(off = ip->dstart; off < ip->size; off += m){
+    m = min(ip->size - off, BSIZE);
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 0, 1));
+    memmove(bp->data, p + (off - ip->dstart), m);
+    log_write(bp);
+    brelse(bp);
+  }
+  iupdate(ip);
+  kfree(p);
+}
+
+// Try to absorb a write of n bytes at off into ip's delayed data.
+// Return the number of bytes written, 0 if the write has to go
+// to the blocks instead (after iflush()), or -1 on error.
+static int
+idelay(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint start;
+  char *p;
+
+  if(ip->type != T_FILE || (ip->dbuf == 0 && off != ip->size))
+    return 0;
+  start = ip->dbuf ? ip->dstart : off - off % BSIZE;
+  if(off < start || off + n > start + NDELAY*BSIZE)
+    return 0;
+
+  if(ip->dbuf == 0){
+    if((p = kalloc()) == 0)
+      return 0;
+    // the partial last block, if any.
+    if(readi(ip, 0, (uint64)p, start, off - start) != off - start){
+      kfree(p);
+      return 0;
+    }
+    ip->dbuf = p;
+    ip->dstart = start;
+    ip->dsize = ip->size;
+  }
+
+  if(either_copyin(ip->dbuf + (off - start), user_src, src, n) == -1)
+    return -1;
+  if(off + n > ip->size)
+    ip->size = off + n;
+  return n;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -448,14 +936,53 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+static char zeroes[BSIZE];
+
+// Move up to k whole blocks, starting at disk block addr and
+// consecutive on disk, straight between the disk and the user
+// memory at va, without copying through the buffer cache.
+// That is only right if none of the blocks is cached, since
+// a cached block may be newer than the disk, or be headed
+// there through the log. Caller must hold ip->lock, so no
+// one else can write ip's blocks meanwhile (holding it
+// shared is enough for a read: other readers only bring
+// in blocks as they are on disk).
+// Return how many blocks were moved, or 0.
+static uint
+iodirect(struct inode *ip, uint64 va, uint addr, uint k, int write)
+{
+  uint64 pa[NSEG];
+  int i;
+
+  k = min(k, NSEG);
+  for(i = 0; i < k; i++){
+    // a block never straddles a page, since va is BSIZE-aligned.
+    if((pa[i] = useraddr(myproc()->pagetable, va + i*BSIZE, !write)) == 0)
+      return 0;
+  }
+  if(bcached(ip->dev, addr, k))
+    return 0;
+  virtio_disk_direct(addr, pa, k, write);
+  return k;
+}
+
+// Should a transfer of n more bytes at file offset off
+// and user address va try iodirect()?
+static int
+isdirect(int user, uint64 va, uint off, uint n)
+{
+  return user && n >= DIRECTMIN*BSIZE && off % BSIZE == 0 && va % BSIZE == 0;
+}
+
 // Read data from inode.
+// Holes, which only directories have, read as zeroes.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run, k, lim;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -463,9 +990,34 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+  addr = run = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m, addr+=k, run-=k){
+    if(ip->dbuf && off >= ip->dstart){
+      // the rest is delayed data, not yet in blocks.
+      if(either_copyout(user_dst, dst, ip->dbuf + (off - ip->dstart), n - tot) == -1)
+        return -1;
+      return n;
+    }
+    if(run == 0)
+      addr = bmap(ip, off/BSIZE, &run, 0);
     m = min(n - tot, BSIZE - off%BSIZE);
+    lim = n - tot;  // bytes that are in blocks
+    if(ip->dbuf)
+      lim = min(lim, ip->dstart - off);
+    if(addr && isdirect(user_dst, dst, off, lim) &&
+       (k = iodirect(ip, dst, addr, min(run, lim/BSIZE), 0)) > 0){
+      m = k*BSIZE;
+      continue;
+    }
+    k = 1;
+    if(addr == 0){
+      if(either_copyout(user_dst, dst, zeroes, m) == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    bp = bread(ip->dev, addr);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -486,7 +1038,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run, k;
+  int r;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -494,8 +1047,20 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if((r = idelay(ip, user_src, src, off, n)) != 0)
+    return r;
+  iflush(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    // overwrite blocks that are already allocated and not
+    // cached straight from user memory, without logging them.
+    if(isdirect(user_src, src, off, n - tot) &&
+       (addr = bmap(ip, off/BSIZE, &run, 0)) != 0 &&
+       (k = iodirect(ip, src, addr, min(run, (n - tot)/BSIZE), 1)) > 0){
+      m = k*BSIZE;
+      continue;
+    }
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 0, 1));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
@@ -524,18 +1089,284 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// FNV-1a hash of a directory entry name.
+// mkfs has a copy, which must agree.
+static uint
+namehash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Directory lookup cache.
+//
+// dirlookup() remembers what it finds, and what it fails
+// to find, keyed by directory and name, so that repeated
+// lookups of the same path need not read the directories
+// again. An entry with inum 0 records that the name is not
+// in the directory. Entries for a directory are only made
+// or changed with that directory's inode locked, the same
+// as the directory's contents, so they cannot go stale.
+// dcache.lock protects the table itself.
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;             // 0 if entry is unused
+  uint dir;             // inode number of the directory
+  char name[DIRSIZ];
+  uint inum;            // 0 if name is not in dir
+  uint off;             // byte offset of name's dirent in dir
+  struct dentry *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  int hand;             // next entry to reuse
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  return (namehash(name) ^ dev ^ (dir * 16777619)) % NDHASH;
+}
+
+// Find the entry for name in directory (dev, dir).
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dir, name)]; d; d = d->next)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d off its hash chain.
+// Caller must hold dcache.lock.
+static void
+dremove(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->dev = 0;
+}
+
+// Look for name in the cache of directory dp's entries.
+// If present, return 1 and set *pinum and *poff.
+// Caller must hold dp->lock.
+static int
+dcachelookup(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+  struct dentry *d;
+  int hit = 0;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    *pinum = d->inum;
+    *poff = d->off;
+    hit = 1;
+  }
+  release(&dcache.lock);
+  return hit;
+}
+
+// Record that name in directory dp is inum (or absent,
+// if inum is 0), with its dirent at byte offset off.
+// Caller must hold dp->lock.
+static void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    d = &dcache.entry[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDENTRY;
+    if(d->dev)
+      dremove(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dir, d->name);
+    d->next = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Record that name has been removed from directory dp.
+// Caller must hold dp->lock.
+void
+dcacheforget(struct inode *dp, char *name)
+{
+  dcacheenter(dp, name, 0, 0);
+}
+
+// Drop all entries for directory inode (dev, dir),
+// which is being freed and may be reused.
+static void
+dcachepurge(uint dev, uint dir)
+{
+  int i;
+
+  acquire(&dcache.lock);
+  for(i = 0; i < NDENTRY; i++)
+    if(dcache.entry[i].dev == dev && dcache.entry[i].dir == dir)
+      dremove(&dcache.entry[i]);
+  release(&dcache.lock);
+}
+
+// The block chained after bucket block bn of hashed
+// directory dp, given its dirhead's next, or 0 if none.
+// Chains only go forward, so following one always ends.
+static uint
+chainnext(struct inode *dp, uint bn, uint next)
+{
+  if(next <= bn || next >= dp->size / BSIZE)
+    return 0;
+  return next;
+}
+
+// Look for name in bucket block bn of hashed directory dp.
+// Return its inum and set *poff, or return 0, setting
+// *pnext to the block chained after this one, if any.
+static uint
+bucketlookup(struct inode *dp, uint bn, char *name, uint *poff, uint *pnext)
+{
+  uint addr, inum;
+  int i;
+  struct buf *bp;
+  struct dirent *de;
+
+  *pnext = 0;
+  if((addr = bmap(dp, bn, 0, 0)) == 0)
+    return 0;
+  bp = bread(dp->dev, addr);
+  de = (struct dirent*)bp->data;
+  *pnext = chainnext(dp, bn, ((struct dirhead*)de)->next);
+  inum = 0;
+  for(i = 1; i < DPB; i++){
+    if(de[i].inum && namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      *poff = bn*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Look for name in its bucket of hashed directory dp.
+static uint
+dirhashlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint bn, inum;
+
+  for(bn = 1 + namehash(name) % dp->major; bn != 0; ){
+    if((inum = bucketlookup(dp, bn, name, poff, &bn)) != 0)
+      return inum;
+  }
+  return 0;
+}
+
+// Put (name, inum) in the first free slot of name's bucket
+// in hashed directory dp, chaining a new block onto the
+// bucket if it is full. Only the block that gets the entry
+// and the last block of a full chain are written, so a link
+// dirties a bounded number of blocks however big dp gets.
+// Returns -1 if dp cannot grow any more.
+static int
+dirhashlink(struct inode *dp, char *name, uint inum)
+{
+  uint bn, next, addr;
+  int j;
+  struct buf *bp;
+  struct dirent *de;
+  struct dirhead *dh;
+
+  for(bn = 1 + namehash(name) % dp->major; ; bn = next){
+    if((addr = bmap(dp, bn, 0, 0)) == 0){
+      // a new block, maybe with an indirect block:
+      // the i-node's addrs change.
+      addr = bmap(dp, bn, 0, 1);
+      iupdate(dp);
+    }
+    bp = bread(dp->dev, addr);
+    de = (struct dirent*)bp->data;
+    for(j = 1; j < DPB; j++){
+      if(de[j].inum == 0){
+        strncpy(de[j].name, name, DIRSIZ);
+        de[j].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        dcacheenter(dp, name, inum, bn*BSIZE + j*sizeof(*de));
+        return 0;
+      }
+    }
+    dh = (struct dirhead*)de;
+    if((next = chainnext(dp, bn, dh->next)) == 0){
+      // the bucket is full: chain on a new last block.
+      next = dp->size / BSIZE;
+      if(next >= MAXFILE){
+        brelse(bp);
+        return -1;
+      }
+      dh->next = next;
+      log_write(bp);
+      dp->size += BSIZE;
+      iupdate(dp);
+    }
+    brelse(bp);
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, end;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  // The first block, or all of an unhashed directory.
+  end = dp->major ? BSIZE : dp->size;
+  for(off = 0; off < end; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
     if(de.inum == 0)
@@ -545,10 +1376,19 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  if(dp->major && (inum = dirhashlookup(dp, name, &off)) != 0){
+    if(poff)
+      *poff = off;
+    dcacheenter(dp, name, inum, off);
+    return iget(dp->dev, inum);
+  }
+
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -556,7 +1396,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off, end;
   struct dirent de;
   struct inode *ip;
 
@@ -566,22 +1406,62 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  // Look for an empty dirent in the first block,
+  // or anywhere in an unhashed directory.
+  end = dp->major ? BSIZE : dp->size;
+  for(off = 0; off < end; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
       break;
   }
 
+  if(off == BSIZE && dp->size == BSIZE && dp->major == 0){
+    // The first block is full: switch to hash buckets.
+    // Directories that grew large before hashing
+    // existed stay as they are.
+    dp->major = NDIRBUCKET;
+    dp->size = (1 + NDIRBUCKET) * BSIZE;
+    iupdate(dp);
+  }
+  if(dp->major && off >= BSIZE)
+    return dirhashlink(dp, name, inum);
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+    return -1;
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
 
+// Is the directory dp empty except for "." and ".." ?
+int
+isdirempty(struct inode *dp)
+{
+  uint bn, addr;
+  int i, empty;
+  struct buf *bp;
+  struct dirent *de;
+
+  empty = 1;
+  for(bn = 0; empty && bn*BSIZE < dp->size; bn++){
+    if((addr = bmap(dp, bn, 0, 0)) == 0)
+      continue;
+    bp = bread(dp->dev, addr);
+    de = (struct dirent*)bp->data;
+    for(i = bn == 0 ? 2 : 0; i < DPB && bn*BSIZE + i*sizeof(*de) < dp->size; i++){
+      if(de[i].inum != 0){
+        empty = 0;
+        break;
+      }
+    }
+    brelse(bp);
+  }
+  return empty;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -636,21 +1516,24 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // lookups only read the directory, so walks through
+    // the same directories can go on side by side.
+    ilock_shared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlock_shared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlock_shared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlock_shared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -6,8 +6,10 @@
 #define BSIZE 1024  // block size
 
 // Disk layout:
-// [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+// [ boot block | super block | log | group 0 | group 1 | ... ]
+//
+// where each allocation group (the last may be shorter) is
+// [ inode bit map | free bit map | inode blocks | data blocks ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -18,39 +20,66 @@ struct superblock {
   uint ninodes;      // Number of inodes.
   uint nlog;         // Number of log blocks
   uint logstart;     // Block number of first log block
-  uint inodestart;   // Block number of first inode block
-  uint bmapstart;    // Block number of first free map block
+  uint groupstart;   // Block number of first group
+  uint ngroups;      // Number of allocation groups
+  uint groupsize;    // Blocks per group
+  uint ipg;          // Inodes per group, a multiple of IPB
 };
 
-#define FSMAGIC 0x10203040
+#define FSMAGIC 0x10203041
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEVICE only)
+  short major;          // Major device number (T_DEVICE only),
+                        // or hash buckets (T_DIR only, 0 if none)
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
+// First block of group g
+#define GSTART(g, sb)     (sb.groupstart + (g) * sb.groupsize)
+
+// Group holding block b
+#define BGROUP(b, sb)     (((b) - sb.groupstart) / sb.groupsize)
+
+// Group holding inode i
+#define IGROUP(i, sb)     ((i) / sb.ipg)
+
+// Inode bit map of group g
+#define IBMAP(g, sb)      GSTART(g, sb)
+
 // Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
+#define IBLOCK(i, sb)     (GSTART(IGROUP(i, sb), sb) + 2 + (i) % sb.ipg / IPB)
 
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
-// Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
+// Block of free map containing bit for block b,
+// which is bit b - GSTART(BGROUP(b, sb), sb)
+#define BBLOCK(b, sb) (GSTART(BGROUP(b, sb), sb) + 1)
 
 // Directory is a file containing a sequence of dirent structures.
+// An entry with inum 0 is unused.
+//
+// Once its first block fills up, a directory becomes hashed:
+// its dinode's major says how many buckets it has, and file
+// block 1+i is bucket i, allocated when first needed. Names
+// that do not fit in the first block go in the first free
+// slot of their hash bucket. The first slot of each bucket
+// block is a struct dirhead, which reads as an unused entry.
+// When a bucket fills up, a new block appended to the
+// directory is chained on by the last block's dirhead.
 #define DIRSIZ 14
 
 struct dirent {
@@ -58,3 +87,17 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Header in the first slot of a bucket block.
+struct dirhead {
+  ushort inum;           // always 0
+  ushort pad;
+  uint next;             // file block continuing the bucket, or 0
+  char unused[DIRSIZ-6];
+};
+
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// Buckets in a newly hashed directory.
+#define NDIRBUCKET    128
+
@@ -0,0 +1,8 @@
+#ifndef _IOVEC_H_
+#define _IOVEC_H_
+// One buffer of a readv() or writev().
+struct iovec {
+  void *base;     // user address
+  int len;        // bytes
+};
+#endif // _IOVEC_H_
@@ -6,34 +6,59 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "logstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when there
+// are no FS system calls active. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
+// the count of in-progress FS system calls and reserves
+// MAXOPBLOCKS of log space for it, and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the open transaction is handed to commit().
+// System calls that write more, like large write()s, use
+// begin_opn()/end_opn() to reserve up to logopmax() blocks.
+//
+// The size of the log comes from the superblock, so mkfs
+// decides how big a transaction can get (up to LOGSIZE).
+//
+// Group commit: there are two in-memory log headers. log.lh
+// collects the open transaction. When the last outstanding
+// end_op() closes it, commit() moves it to log.clh, copies its
+// blocks out of the buffer cache, and lets new system calls start
+// a fresh log.lh while it writes the copies to the log and to
+// their home locations. Transactions that close while a commit
+// is in progress are committed by the same process when it
+// finishes, so concurrent writers pipeline behind one committer.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
+//     and a CRC32C checksum of the transaction
 //   block A
 //   block B
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// The checksum covers the header itself and every logged block.
+// Recovery only replays a transaction whose checksum matches, so
+// a crash that tears the header or leaves a log block unwritten
+// discards the (uncommitted) transaction. That lets commit()
+// write the log blocks and the header without a disk flush
+// between them.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  uint crc;  // of this header, with crc = 0, then the logged blocks
   int block[LOGSIZE];
 };
 
@@ -42,58 +67,177 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by the outstanding sys calls.
+  int committing;  // in commit(), please wait to commit.
+  int snapshot;    // commit() is copying blocks out of the cache, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the open transaction.
+  struct logheader clh; // the transaction being committed.
+  int absorbed;         // log_write()s absorbed into log.lh.
+  uint64 closed;        // transactions handed to commit() so far.
+  uint64 done;          // transactions fully committed so far.
+  struct logstat stat;
+
+  // commit()'s private copies of the committing transaction's
+  // blocks. they are not in the buffer cache, so the next
+  // transaction can keep modifying the cached blocks while
+  // these are written to the log and then to home locations.
+  struct buf *cached[LOGSIZE]; // the pinned cache bufs
+  struct buf copy[LOGSIZE];
+  struct buf head;             // the on-disk header block
+  int order[LOGSIZE];          // indices of copy[] in the order to write them
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
 
+// CRC32C (Castagnoli), reflected, one table lookup per byte.
+#define CRC32C_POLY 0x82F63B78
+static uint crctab[256];
+
+static void
+crc32cinit(void)
+{
+  uint c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++)
+      c = (c >> 1) ^ (c & 1 ? CRC32C_POLY : 0);
+    crctab[i] = c;
+  }
+}
+
+// Extend crc, the CRC32C of some preceding bytes (0 if none),
+// over the n bytes at p.
+static uint
+crc32c(uint crc, void *p, int n)
+{
+  uchar *s = p;
+  uint c = ~crc;
+
+  while (n-- > 0)
+    c = crctab[(c ^ *s++) & 0xff] ^ (c >> 8);
+  return ~c;
+}
+
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
+  if (sb->nlog - 1 > LOGSIZE || sb->nlog - 1 < MAXOPBLOCKS)
+    panic("initlog: bad log size");
+
+  crc32cinit();
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.stat.size = log.size - 1;
   log.dev = dev;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Write (or read) the n copies listed in log.order to (or from)
+// the blocks given by their blockno, as one batch of disk
+// requests. Runs of consecutive blocks go to the disk as single
+// multi-block requests.
 static void
-install_trans(int recovering)
+copy_rw(int n, int write)
 {
-  int tail;
+  struct buf *run[NSEG], *b;
+  int i, nrun;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  nrun = 0;
+  for (i = 0; i < n; i++) {
+    b = &log.copy[log.order[i]];
+    if (nrun > 0 && (nrun == NSEG || b->blockno != run[nrun-1]->blockno + 1)) {
+      virtio_disk_submit(run, nrun, write);
+      nrun = 0;
+    }
+    run[nrun++] = b;
   }
+  if (nrun > 0)
+    virtio_disk_submit(run, nrun, write);
+  virtio_disk_kick();
+  for (i = 0; i < n; i++)
+    virtio_disk_wait(&log.copy[log.order[i]]);
 }
 
-// Read the log header from disk into the in-memory log header
+// Copy committed blocks from log to their home location.
+// The writes are issued in home block order, so that
+// neighbouring blocks are coalesced into one request,
+// and are all in flight at once.
+static void
+install_trans(void)
+{
+  int tail, i;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    log.copy[tail].blockno = log.clh.block[tail];  // write dst
+    // insertion sort by home block number.
+    for (i = tail; i > 0 && log.clh.block[log.order[i-1]] > log.clh.block[tail]; i--)
+      log.order[i] = log.order[i-1];
+    log.order[i] = tail;
+  }
+  copy_rw(log.clh.n, 1);
+  virtio_disk_flush();  // the installs are durable before the log is erased
+}
+
+// Put the copies in log order, for reading or writing the log.
+static void
+log_order(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++)
+    log.order[tail] = tail;
+}
+
+// Read the log header from disk into the in-memory log header.
+// Its checksum is only checked once the logged blocks are read.
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct logheader *lh = (struct logheader *) (log.head.data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+
+  log.head.dev = log.dev;
+  log.head.blockno = log.start;
+  virtio_disk_rw(&log.head, 0);
+  log.clh.n = 0;
+  if (lh->n == 0)   // empty, as mkfs leaves it
+    return;
+  if (lh->n < 0 || lh->n > log.size - 1) {
+    printf("log: bad header, not replayed\n");
+    return;
   }
-  brelse(buf);
+  log.clh.n = lh->n;
+  log.clh.crc = lh->crc;
+  for (i = 0; i < log.clh.n; i++)
+    log.clh.block[i] = lh->block[i];
+}
+
+// Fill in hb from the in-memory log header, and return the
+// checksum of the transaction: hb, with crc = 0, followed by
+// the copies of the logged blocks.
+static uint
+log_crc(struct logheader *hb)
+{
+  uint crc;
+  int i;
+
+  memset(hb, 0, sizeof(*hb));
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++)
+    hb->block[i] = log.clh.block[i];
+  crc = crc32c(0, hb, sizeof(*hb));
+  for (i = 0; i < log.clh.n; i++)
+    crc = crc32c(crc, log.copy[i].data, BSIZE);
+  return crc;
 }
 
 // Write in-memory log header to disk.
@@ -102,57 +246,109 @@ read_head(void)
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
-  bwrite(buf);
-  brelse(buf);
+  struct logheader *hb = (struct logheader *) (log.head.data);
+
+  hb->crc = log_crc(hb);
+  log.head.dev = log.dev;
+  log.head.blockno = log.start;
+  virtio_disk_rw(&log.head, 1);
 }
 
 static void
 recover_from_log(void)
 {
+  int tail;
+
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  for (tail = 0; tail < log.clh.n; tail++) {
+    log.copy[tail].dev = log.dev;
+    log.copy[tail].blockno = log.start+tail+1; // read log block
+  }
+  log_order();
+  copy_rw(log.clh.n, 0);
+  // a torn header, or a header that went to disk ahead of
+  // one of its blocks: the transaction never committed.
+  if (log.clh.n > 0 &&
+     log_crc((struct logheader *) (log.head.data)) != log.clh.crc) {
+    printf("log: bad checksum, %d blocks not replayed\n", log.clh.n);
+    log.clh.n = 0;
+  }
+  install_trans(); // if committed, copy from log to disk
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Wait until the updates of every system call that has
+// finished so far are committed, then make writes that
+// went around the log (see iodirect() in fs.c) durable too.
 void
-begin_op(void)
+logsync(void)
 {
+  uint64 want;
+
+  acquire(&log.lock);
+  // the open transaction if it has anything in it,
+  // else the one being committed, if any.
+  want = log.lh.n > 0 ? log.closed + 1 : log.closed;
+  while(log.done < want)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+  virtio_disk_flush();
+}
+
+// The most log blocks a single FS system call may reserve:
+// all of the log but room for one ordinary system call.
+int
+logopmax(void)
+{
+  return log.size - 1 - MAXOPBLOCKS;
+}
+
+// called at the start of an FS system call that
+// may write up to n blocks.
+void
+begin_opn(int n)
+{
+  if(n > logopmax())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.snapshot){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.size - 1){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of an FS system call that began
+// with begin_opn(n).
+// commits if this was the last outstanding operation,
+// unless another process is already committing, in which
+// case that process will pick this transaction up.
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -167,39 +363,96 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Copy the committing transaction's blocks out of the cache.
+// No FS system call is active, and begin_op() waits for
+// log.snapshot, so the cached blocks can't change under us.
 static void
-write_log(void)
+snapshot(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    log.cached[tail] = from;
+    log.copy[tail].dev = log.dev;
+    memmove(log.copy[tail].data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the copies of modified blocks to the log.
+static void
+write_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++)
+    log.copy[tail].blockno = log.start+tail+1; // log block
+  log_order();
+  copy_rw(log.clh.n, 1);
+  // no flush: recovery checks the blocks against the
+  // header's checksum, so they need not reach the disk first.
+}
+
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  int i, n;
+
+  acquire(&log.lock);
+  while (log.outstanding == 0 && log.lh.n > 0) {
+    // close the open transaction. system calls that
+    // begin from now on go into a fresh log.lh.
+    log.clh = log.lh;
     log.lh.n = 0;
+    log.closed += 1;
+    log.stat.ncommit += 1;
+    log.stat.nblocks += log.clh.n;
+    log.stat.nabsorb += log.absorbed;
+    log.stat.lastblocks = log.clh.n;
+    log.stat.lastabsorb = log.absorbed;
+    log.absorbed = 0;
+    log.snapshot = 1;
+    release(&log.lock);
+
+    snapshot();
+
+    acquire(&log.lock);
+    log.snapshot = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log();     // Write modified blocks from the copies to log
+    write_head();    // Write header to disk -- the real commit
+    virtio_disk_flush(); // the commit is durable before any install
+    install_trans(); // Now install writes to home locations
+    n = log.clh.n;
+    log.clh.n = 0;
     write_head();    // Erase the transaction from the log
+    // only now may the blocks leave the cache: until the
+    // log is erased, recovery could replay them over
+    // anything written straight to their home locations.
+    for (i = 0; i < n; i++)
+      bunpin(log.cached[i]);
+
+    // hold on to the lock into the next iteration's check.
+    acquire(&log.lock);
+    log.done += 1;
+    wakeup(&log);
   }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -230,7 +483,18 @@ log_write(struct buf *b)
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
     log.lh.n++;
+  } else {
+    log.absorbed++;
   }
   release(&log.lock);
 }
 
+// Copy the log's commit statistics into *st.
+void
+logstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  release(&log.lock);
+}
+
@@ -0,0 +1,12 @@
+#ifndef _LOGSTAT_H_
+#define _LOGSTAT_H_
+// Write-ahead log statistics, returned by getlogstat().
+struct logstat {
+  int size;       // data blocks the on-disk log can hold
+  int ncommit;    // transactions committed since boot
+  int nblocks;    // blocks those transactions wrote to the log
+  int nabsorb;    // log_write()s absorbed into a block already in a transaction
+  int lastblocks; // blocks in the most recent transaction
+  int lastabsorb; // absorbed log_write()s in the most recent transaction
+};
+#endif // _LOGSTAT_H_
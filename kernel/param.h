@@ -1,14 +1,26 @@
 #define NPROC        64  // maximum number of processes
+#define NWAITQ       61  // wait queues, hashed by sleep channel
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes in memory at boot (more as needed)
+#define NDENTRY     128  // size of directory lookup cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NIOV         16  // max buffers in a readv() or writev()
+#define NPIPESEG     16  // max half-page segments in a pipe's buffer (power of 2)
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      254  // max data blocks in on-disk log (one header block)
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*3)  // size of disk block cache
+#define FSSIZE       4000  // size of file system in blocks
+#define NGROUP       16    // max allocation groups in file system
 #define MAXPATH      128   // maximum file path name
-#define SCHEDULER     2 // 1 - original, 2 - round-robin with queue, and 3 - stride
\ No newline at end of file
+#define NSEG         16   // max blocks in a single disk request
+#define DIRECTMIN    16   // min blocks in a read or write to bypass the buffer cache
+#define PREALLOC     8    // free blocks sought ahead of a growing file
+#define NDELAY       4    // blocks of appended data held in memory (one page)
+#define SCHEDULER     2 // 1 - original, 2 - round-robin with queue, and 3 - stride
+#define SPINLOCK      2 // 1 - test-and-set, 2 - ticket (FIFO)
+#define LOCKSTAT      0 // 1 - count spinlock contention, shown by procdump()
+#define NLOCKSTAT    32 // lock names with their own counters
\ No newline at end of file
@@ -7,18 +7,58 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "iovec.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of nseg segments of PIPESIZE bytes.
+// The first is in struct pipe itself; a pipe that fills up
+// doubles nseg, up to NPIPESEG, the next time it is empty.
+// The rest come from kalloc()ed pages, two to a page; when
+// nseg doubles to 2, the extra half page is kept for later.
+// nseg is a power of 2, so the ring size divides 2^32 and
+// nread and nwrite can wrap around.
+#define PIPESIZE (PGSIZE/2)
 
 struct pipe {
   struct spinlock lock;
   char data[PIPESIZE];
+  char *seg[NPIPESEG+1]; // segments of the ring (and a spare)
+  uint nseg;      // segments in use
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
+  int full;       // a writer found the ring full
+  int wbusy;      // splice() is filling free space in place
+  int rbusy;      // splice() is draining data in place
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static uint
+pipesize(struct pipe *pi)
+{
+  return pi->nseg * PIPESIZE;
+}
+
+// Double the ring. Only when it is empty, so no bytes move.
+// Caller must hold pi->lock.
+static void
+pipegrow(struct pipe *pi)
+{
+  uint k, n;
+  char *pg;
+
+  n = 2 * pi->nseg;
+  for(k = pi->nseg; k < n; k++){
+    if(pi->seg[k])
+      continue;
+    if((pg = kalloc()) == 0)
+      return;
+    pi->seg[k] = pg;
+    pi->seg[k+1] = pg + PIPESIZE;
+  }
+  pi->nseg = n;
+  pi->nread = pi->nwrite = 0;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -34,6 +74,12 @@ pipealloc(struct file **f0, struct file **f1)
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  memset(pi->seg, 0, sizeof(pi->seg));
+  pi->seg[0] = pi->data;
+  pi->nseg = 1;
+  pi->full = 0;
+  pi->wbusy = 0;
+  pi->rbusy = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -55,6 +101,17 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+static void
+pipefree(struct pipe *pi)
+{
+  int k;
+
+  for(k = 1; k <= NPIPESEG; k++)
+    if(pi->seg[k] && (uint64)pi->seg[k] % PGSIZE == 0)
+      kfree(pi->seg[k]);
+  kfree((char*)pi);
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
@@ -68,15 +125,35 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Copy as much of the n bytes at user address addr into
+// the ring as fits before it wraps or fills.
+// Caller must hold pi->lock and have checked there is room.
+static int
+pipecopyin(struct pipe *pi, uint64 addr, int n)
+{
+  uint off, m;
+
+  off = pi->nwrite % pipesize(pi);
+  m = pipesize(pi) - (pi->nwrite - pi->nread);
+  if(m > PIPESIZE - off % PIPESIZE)
+    m = PIPESIZE - off % PIPESIZE;
+  if(m > n)
+    m = n;
+  if(copyin(myproc()->pagetable, pi->seg[off / PIPESIZE] + off % PIPESIZE, addr, m) == -1)
+    return -1;
+  pi->nwrite += m;
+  return m;
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,15 +162,21 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->nwrite == pi->nread + pipesize(pi)){ //DOC: pipewrite-full
+      if(pi->nseg < NPIPESEG)
+        pi->full = 1;
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
+    } else if(pi->wbusy){
+      sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      if(pi->full && pi->nread == pi->nwrite){
+        pi->full = 0;
+        pipegrow(pi);
+      }
+      if((m = pipecopyin(pi, addr + i, n - i)) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -106,25 +189,147 @@ int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
+  uint off, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  // copy out up to where the data ends or the segment does.
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % pipesize(pi);
+    m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - off % PIPESIZE)
+      m = PIPESIZE - off % PIPESIZE;
+    if(m > n - i)
+      m = n - i;
+    if(copyout(pr->pagetable, addr + i, pi->seg[off / PIPESIZE] + off % PIPESIZE, m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// splice() moves data between a pipe and a file with no copy
+// through user memory: it reserves part of the ring, has readi()
+// or writei() fill or drain it in place, and then hands it back.
+// While it does, other writers (or readers) wait.
+
+// Describe the n bytes of the ring starting at count from
+// as at most NPIPESEG+1 kernel buffers in iov.
+// Return how many.
+static int
+pipespans(struct pipe *pi, uint from, uint n, struct iovec *iov)
+{
+  uint off, m;
+  int k;
+
+  for(k = 0; n > 0; k++, from += m, n -= m){
+    off = from % pipesize(pi);
+    m = PIPESIZE - off % PIPESIZE;
+    if(m > n)
+      m = n;
+    iov[k].base = pi->seg[off / PIPESIZE] + off % PIPESIZE;
+    iov[k].len = m;
+  }
+  return k;
+}
+
+// Wait for free space in the ring, and reserve up to n bytes
+// of it for the caller to fill, described in iov.
+// Return the number of buffers in iov, or -1 if the
+// read side is closed.
+int
+pipebeginwrite(struct pipe *pi, struct iovec *iov, int n)
+{
+  uint m;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->nwrite == pi->nread + pipesize(pi) || pi->wbusy){
+    if(pi->readopen == 0 || pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    if(!pi->wbusy && pi->nseg < NPIPESEG)
+      pi->full = 1;
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0 || pr->killed){
+    release(&pi->lock);
+    return -1;
+  }
+  if(pi->full && pi->nread == pi->nwrite){
+    pi->full = 0;
+    pipegrow(pi);
+  }
+  m = pipesize(pi) - (pi->nwrite - pi->nread);
+  if(m > n)
+    m = n;
+  pi->wbusy = 1;
+  n = pipespans(pi, pi->nwrite, m, iov);
+  release(&pi->lock);
+  return n;
+}
+
+// The caller has put n bytes in the space
+// from pipebeginwrite(). Pass them to readers.
+void
+pipeendwrite(struct pipe *pi, int n)
+{
+  acquire(&pi->lock);
+  pi->nwrite += n;
+  pi->wbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+}
+
+// Reserve up to n bytes of the data in the ring for the caller
+// to drain, described in iov, waiting for some if wait is set.
+// Return the number of buffers in iov: 0 at end of file or
+// when there is no data and wait is clear, or -1 if killed.
+int
+pipebeginread(struct pipe *pi, struct iovec *iov, int n, int wait)
+{
+  uint m;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while((pi->nread == pi->nwrite && pi->writeopen && wait) || pi->rbusy){
+    if(pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  m = pi->nwrite - pi->nread;
+  if(m > n)
+    m = n;
+  if(m > 0)
+    pi->rbusy = 1;
+  n = pipespans(pi, pi->nread, m, iov);
+  release(&pi->lock);
+  return n;
+}
+
+// The caller has taken n bytes of the data
+// from pipebeginread(). Free their space for writers.
+void
+pipeendread(struct pipe *pi, int n)
+{
+  acquire(&pi->lock);
+  pi->nread += n;
+  pi->rbusy = 0;
+  wakeup(&pi->nwrite);
+  wakeup(&pi->nread);
+  release(&pi->lock);
+}
@@ -17,20 +17,87 @@
 
 volatile int panicked = 0;
 
-// lock to avoid interleaving concurrent printf's.
+// Each CPU's printf() output goes into its own ring, with no
+// lock: only that CPU adds to it, with interrupts off, and only
+// the UART driver, holding uart_tx_lock, takes from it (see
+// prgetc()). printf() makes a whole message visible at once by
+// advancing w at the end, and then has the UART interrupt, so
+// the message goes out later, from uartintr(). If the ring is
+// full, the rest of the message is lost.
+// panic() prints synchronously instead.
+#define PRBUFSIZE 4096
+
+struct prbuf {
+  char buf[PRBUFSIZE];
+  volatile uint w;  // end of complete messages
+  volatile uint r;  // next to send
+  uint pw;          // end of the message being formatted
+};
+
 static struct {
-  struct spinlock lock;
-  int locking;
+  int sync;         // print straight to the UART
+  int cur;          // ring the UART is sending from
+  struct prbuf buf[NCPU];
 } pr;
 
 static char digits[] = "0123456789abcdef";
 
 static void
-printint(int xx, int base, int sign)
+prputc(int c)
+{
+  struct prbuf *pb;
+
+  if(pr.sync){
+    consputc(c);
+    return;
+  }
+  pb = &pr.buf[cpuid()];
+  if(pb->pw - pb->r < PRBUFSIZE)
+    pb->buf[pb->pw++ % PRBUFSIZE] = c;
+}
+
+// Take the next character of printf() output, or return
+// -1 if there is none. Sticks to one CPU's ring until it
+// is empty, so that messages don't interleave.
+// Caller must hold uart_tx_lock.
+int
+prgetc(void)
+{
+  struct prbuf *pb;
+  int i, c;
+
+  for(i = 0; i < NCPU; i++){
+    pb = &pr.buf[pr.cur];
+    if(pb->r != pb->w){
+      __sync_synchronize();  // read the bytes after w
+      c = pb->buf[pb->r % PRBUFSIZE];
+      __sync_synchronize();  // before freeing their space
+      pb->r++;
+      return c;
+    }
+    pr.cur = (pr.cur + 1) % NCPU;
+  }
+  return -1;
+}
+
+// Send all buffered output, spinning on the UART.
+// Only for panic(), when nothing else can be relied on.
+static void
+prflush(void)
+{
+  struct prbuf *pb;
+
+  for(pb = pr.buf; pb < pr.buf + NCPU; pb++)
+    while(pb->r != pb->w)
+      consputc(pb->buf[pb->r++ % PRBUFSIZE]);
+}
+
+static void
+printint(long xx, int base, int sign)
 {
-  char buf[16];
+  char buf[24];
   int i;
-  uint x;
+  uint64 x;
 
   if(sign && (sign = xx < 0))
     x = -xx;
@@ -46,38 +113,36 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    prputc(buf[i]);
 }
 
 static void
 printptr(uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  prputc('0');
+  prputc('x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    prputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
+// Print to the console. only understands %d, %x, %l, %p, %s.
 void
 printf(char *fmt, ...)
 {
   va_list ap;
-  int i, c, locking;
+  int i, c;
   char *s;
-
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
+  struct prbuf *pb;
 
   if (fmt == 0)
     panic("null fmt");
 
+  push_off();  // stay on this CPU, and keep interrupts out of its ring
   va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      prputc(c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -90,6 +155,9 @@ printf(char *fmt, ...)
     case 'x':
       printint(va_arg(ap, int), 16, 1);
       break;
+    case 'l':
+      printint(va_arg(ap, uint64), 10, 0);
+      break;
     case 'p':
       printptr(va_arg(ap, uint64));
       break;
@@ -97,27 +165,33 @@ printf(char *fmt, ...)
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        prputc(*s);
       break;
     case '%':
-      consputc('%');
+      prputc('%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      prputc('%');
+      prputc(c);
       break;
     }
   }
 
-  if(locking)
-    release(&pr.lock);
+  if(!pr.sync){
+    pb = &pr.buf[cpuid()];
+    __sync_synchronize();  // the message is in buf before w moves
+    pb->w = pb->pw;
+    uartkick();
+  }
+  pop_off();
 }
 
 void
 panic(char *s)
 {
-  pr.locking = 0;
+  pr.sync = 1;
+  prflush();
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -129,6 +203,6 @@ panic(char *s)
 void
 printfinit(void)
 {
-  initlock(&pr.lock, "pr");
-  pr.locking = 1;
+  pr.sync = 0;
+  pr.cur = 0;
 }
@@ -31,6 +31,22 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// processes in sleep(), on lists hashed by chan, so that
+// wakeup() need only look at those that might be on chan.
+// a waitq's lock must be acquired before any p->lock.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+static struct waitq*
+chanwaitq(void *chan)
+{
+  uint64 c = (uint64)chan;
+
+  return &waitq[(c ^ (c >> 12)) % NWAITQ];
+}
+
 
 // a node of the linked list
 struct qentry {
@@ -186,9 +202,12 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct waitq *wq;
   queue = newqueue();
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(wq = waitq; wq < &waitq[NWAITQ]; wq++)
+    initlock(&wq->lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -791,6 +810,8 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = chanwaitq(chan);
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
@@ -798,10 +819,18 @@ sleep(void *chan, struct spinlock *lk)
   // guaranteed that we won't miss any wakeup
   // (wakeup locks p->lock),
   // so it's okay to release lk.
+  // Going on chan's wait queue first, under its
+  // lock, makes sure wakeup() will look at p.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
+  p->wq = wq;
+  p->wnext = wq->head;
+  wq->head = p;
+  release(&wq->lock);
+
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
@@ -810,23 +839,45 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() takes p off the queue, but kill() doesn't.
+  acquire(&wq->lock);
+  if(p->wq){
+    for(pp = &wq->head; *pp; pp = &(*pp)->wnext){
+      if(*pp == p){
+        *pp = p->wnext;
+        break;
+      }
+    }
+    p->wq = 0;
+  }
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
 // Wake up all processes sleeping on chan.
+// Only looks at the processes on chan's wait queue.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct proc *p, **pp;
+  struct waitq *wq = chanwaitq(chan);
+  int woke;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&wq->lock);
+  for(pp = &wq->head; (p = *pp) != 0; ) {
+    woke = 0;
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
+        // off the queue; it is awake now.
+        *pp = p->wnext;
+        p->wq = 0;
+        woke = 1;
         p->state = RUNNABLE;
         uint64 pindex = p - proc;
         //adding the process to the queue depending on the scheduler
@@ -850,7 +901,10 @@ wakeup(void *chan)
       }
       release(&p->lock);
     }
+    if(!woke)
+      pp = &p->wnext;
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -953,6 +1007,7 @@ procdump(void)
     printf("%d %s %s", p->pid, state, p->name);
     printf("\n");
   }
+  lockdump();
 }
 
 extern struct proc proc[NPROC];
\ No newline at end of file
@@ -96,6 +96,10 @@ struct proc {
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
+  // the lock of the wait queue p is on must be held when using these:
+  struct waitq *wq;            // Wait queue of chan, while on it
+  struct proc *wnext;          // Next process on that queue
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
@@ -1,4 +1,8 @@
 // Sleeping locks
+//
+// A sleep lock is held either exclusive, by one process, or
+// shared, by any number of readers. Waiting writers hold off
+// new readers, so a stream of readers can't starve them.
 
 #include "types.h"
 #include "riscv.h"
@@ -15,6 +19,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->writers = 0;
   lk->pid = 0;
 }
 
@@ -22,9 +28,11 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->writers++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->writers--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
@@ -40,6 +48,28 @@ releasesleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->writers) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasesleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if (lk->readers < 1)
+    panic("releasesleep_shared");
+  if (--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -1,6 +1,8 @@
 // Long-term locks for processes
 struct sleeplock {
   uint locked;       // Is the lock held?
+  int readers;       // How many hold it shared
+  int writers;       // How many wait to hold it exclusive
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
@@ -8,12 +8,37 @@
 #include "proc.h"
 #include "defs.h"
 
+// Contention counters, one set per lock name; the last
+// entry collects the names that don't fit.
+static struct lockstat lockstat[NLOCKSTAT];
+
+// Find (or claim) the counters for locks named name.
+// No lock protects the table, since it serves the locks:
+// an empty entry is claimed with compare-and-swap.
+static struct lockstat*
+lockstatfor(char *name)
+{
+  struct lockstat *ls;
+
+  for(ls = lockstat; ls < lockstat + NLOCKSTAT - 1; ls++){
+    if(ls->name == 0 && __sync_bool_compare_and_swap(&ls->name, 0, name))
+      return ls;
+    if(strncmp(ls->name, name, 16) == 0)
+      return ls;
+  }
+  ls->name = "(other)";
+  return ls;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->ticket = 0;
+  lk->serving = 0;
   lk->cpu = 0;
+  lk->stat = LOCKSTAT ? lockstatfor(name) : 0;
 }
 
 // Acquire the lock.
@@ -21,16 +46,29 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint t;
+  uint64 spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if (SPINLOCK == 2) {
+    // take a ticket and wait for it to be served, so
+    // CPUs get the lock in the order they asked for it.
+    // On RISC-V, sync_fetch_and_add turns into amoadd.w.
+    t = __sync_fetch_and_add(&lk->ticket, 1);
+    while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != t)
+      spins++;
+    lk->locked = 1;
+  } else {
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      spins++;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +78,15 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  if (LOCKSTAT) {
+    // other locks of the same name may be held on other CPUs.
+    __sync_fetch_and_add(&lk->stat->nacquire, 1);
+    if(spins){
+      __sync_fetch_and_add(&lk->stat->ncontend, 1);
+      __sync_fetch_and_add(&lk->stat->nspin, spins);
+    }
+  }
 }
 
 // Release the lock.
@@ -68,9 +115,29 @@ release(struct spinlock *lk)
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
 
+  // serve the next ticket. only the holder writes lk->serving.
+  if (SPINLOCK == 2)
+    __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+
   pop_off();
 }
 
+// Print the contention counters of the locks, for procdump().
+void
+lockdump(void)
+{
+  struct lockstat *ls;
+
+  if (!LOCKSTAT)
+    return;
+  for(ls = lockstat; ls < lockstat + NLOCKSTAT; ls++){
+    if(ls->name == 0 || ls->nacquire == 0)
+      continue;
+    printf("lock %s: %l acquires, %l contended, %l spins\n",
+           ls->name, ls->nacquire, ls->ncontend, ls->nspin);
+  }
+}
+
 // Check whether this cpu is holding the lock.
 // Interrupts must be off.
 int
@@ -1,9 +1,19 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint ticket;       // Next ticket to hand out (SPINLOCK 2)
+  uint serving;      // Ticket now holding the lock (SPINLOCK 2)
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  struct lockstat *stat; // Counters shared by all locks of this name.
 };
 
+// Contention counters for the locks of one name (LOCKSTAT).
+struct lockstat {
+  char *name;
+  uint64 nacquire;   // acquire()s
+  uint64 ncontend;   // acquire()s that had to spin
+  uint64 nspin;      // spin loop iterations
+};
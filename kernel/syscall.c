@@ -107,6 +107,13 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_nice(void);       //declare kernel side function nice
 extern uint64 sys_getpstat(void);   //declare kernel side function getpstat
+extern uint64 sys_getlogstat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_splice(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -132,6 +139,13 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_nice]    sys_nice,           //declare kernel side function nice
 [SYS_getpstat]    sys_getpstat,   //declare kernel side function getpstat
+[SYS_getlogstat] sys_getlogstat,
+[SYS_fsync]   sys_fsync,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_splice]  sys_splice,
 };
 
 void
@@ -22,3 +22,10 @@
 #define SYS_close  21
 #define SYS_nice   22 //calling nice
 #define SYS_getpstat  23 //calling getpstat
+#define SYS_getlogstat 24
+#define SYS_fsync  25
+#define SYS_pread  26
+#define SYS_pwrite 27
+#define SYS_readv  28
+#define SYS_writev 29
+#define SYS_splice 30
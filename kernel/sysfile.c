@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "logstat.h"
+#include "iovec.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -165,22 +167,6 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
@@ -218,6 +204,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -258,7 +245,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -268,19 +255,31 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto fail;
   }
 
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto fail;
+
+  if(type == T_DIR){
+    // now that success is guaranteed:
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
   return ip;
+
+ fail:
+  // something went wrong. de-allocate ip.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
 }
 
 uint64
@@ -484,3 +483,113 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_getlogstat(void)
+{
+  uint64 addr; // user pointer to struct logstat
+  struct logstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  logstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Fetch the nth and n+1th word-sized system call arguments as
+// a user array of iovecs and its length, and copy the array
+// into iov. Returns the number of iovecs, or -1.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 p, tot;
+  int i, niov;
+
+  if(argaddr(n, &p) < 0 || argint(n+1, &niov) < 0)
+    return -1;
+  if(niov < 0 || niov > NIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, p, niov*sizeof(*iov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < niov; i++){
+    if(iov[i].len < 0)
+      return -1;
+    tot += iov[i].len;
+  }
+  // the total must fit in the int that read and write return.
+  if(tot > 0x7fffffff)
+    return -1;
+  return niov;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || (niov = argiov(1, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, niov);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || (niov = argiov(1, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, niov);
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(fin, fout, n);
+}
@@ -34,13 +34,14 @@
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
 #define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+#define UART_FIFO_SIZE 16     // bytes the transmit FIFO holds
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 1024
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
@@ -77,15 +78,17 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
-// UART to start sending if it isn't already.
-// blocks if the output buffer is full.
+// add n characters from buf to the output buffer, taking
+// the lock once for as many as fit, and start sending.
+// blocks while the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
 // by write().
 void
-uartputc(int c)
+uartwrite(char *buf, int n)
 {
+  int i = 0;
+
   acquire(&uart_tx_lock);
 
   if(panicked){
@@ -93,22 +96,21 @@ uartputc(int c)
       ;
   }
 
-  while(1){
+  while(i < n){
     if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
       // buffer is full.
-      // wait for uartstart() to open up space in the buffer.
+      uartstart();
       sleep(&uart_tx_r, &uart_tx_lock);
     } else {
-      uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
+      uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = buf[i++];
       uart_tx_w += 1;
-      uartstart();
-      release(&uart_tx_lock);
-      return;
     }
   }
+  uartstart();
+  release(&uart_tx_lock);
 }
 
-// alternate version of uartputc() that doesn't 
+// alternate version of uartwrite() that doesn't 
 // use interrupts, for use by kernel printf() and
 // to echo characters. it spins waiting for the uart's
 // output register to be empty.
@@ -130,34 +132,48 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, send them.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
+  int i, c;
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART transmit FIFO is not empty yet.
+    // it will interrupt when it is.
+    return;
+  }
+
+  // the FIFO is empty, so it has room for a
+  // whole burst without checking LSR again.
+  // kernel printf() output goes first.
+  for(i = 0; i < UART_FIFO_SIZE; i++){
+    if((c = prgetc()) < 0){
+      if(uart_tx_r == uart_tx_w)
+        break;
+      c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+      uart_tx_r += 1;
     }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
-    uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
     WriteReg(THR, c);
   }
+
+  // maybe uartwrite() is waiting for space in the buffer.
+  wakeup(&uart_tx_r);
+}
+
+// make the UART interrupt as soon as its transmit FIFO
+// is empty, even if it is already, so that uartintr()
+// sends what printf() has buffered. turning the transmit
+// interrupt off and on again does that on a 16550.
+// takes no locks, so printf() can call it anywhere.
+void
+uartkick(void)
+{
+  WriteReg(IER, IER_RX_ENABLE);
+  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
 }
 
 // read one input character from the UART.
@@ -179,6 +195,8 @@ uartgetc(void)
 void
 uartintr(void)
 {
+  ReadReg(ISR); // acknowledge the interrupt
+
   // read and process incoming characters.
   while(1){
     int c = uartgetc();
@@ -36,6 +36,7 @@
 
 // device feature bits
 #define VIRTIO_BLK_F_RO              5	/* Disk is read-only */
+#define VIRTIO_BLK_F_FLUSH           9	/* Supports the flush command */
 #define VIRTIO_BLK_F_SCSI            7	/* Supports scsi command passthru */
 #define VIRTIO_BLK_F_CONFIG_WCE     11	/* Writeback mode available in config */
 #define VIRTIO_BLK_F_MQ             12	/* support more than one vq */
@@ -44,8 +45,9 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two, and small enough that the
+// descriptors and the avail ring fit in the first page.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -56,6 +58,7 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr points to a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
@@ -83,6 +86,7 @@ struct virtq_used {
 
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
+#define VIRTIO_BLK_T_FLUSH 4 // make completed writes durable
 
 // the format of the first descriptor in a disk request.
 // to be followed by two more descriptors containing
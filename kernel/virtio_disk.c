@@ -56,18 +56,29 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int unkicked;    // requests in the avail ring the device hasn't been told about.
+  int indirect;    // did the device accept VIRTIO_RING_F_INDIRECT_DESC?
+  int flush;       // did the device accept VIRTIO_BLK_F_FLUSH?
+  uint64 nflush;   // flush requests submitted.
+  uint64 nflushed; // flush requests completed.
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // first buf of the request, linked through qnext.
+    int *done;     // set when a request without bufs finishes.
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+
+  // if the device supports indirect descriptors, each request
+  // occupies a single ring descriptor that points to one of
+  // these tables, indexed by that descriptor.
+  struct virtq_desc indirect_desc[NUM][NSEG+2];
   
   struct spinlock vdisk_lock;
   
@@ -101,8 +112,9 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+  disk.flush = (features & (1 << VIRTIO_BLK_F_FLUSH)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -126,7 +138,7 @@ virtio_disk_init(void)
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * virtq_desc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
+  // avail = pages + num * virtq_desc -- 2 * uint16, then num * uint16
   // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
   disk.desc = (struct virtq_desc *) disk.pages;
@@ -184,12 +196,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int n, int *idx)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,81 +211,235 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// tell the device about requests added to the avail
+// ring since the last kick. caller must hold vdisk_lock.
+static void
+kick(void)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  if(disk.unkicked == 0)
+    return;
+  disk.unkicked = 0;
 
-  acquire(&disk.vdisk_lock);
+  __sync_synchronize();
 
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
+// add a request of the given type for n consecutive blocks,
+// starting at blockno, to the avail ring, without notifying the
+// device or waiting. the data of block i is at physical address
+// pa[i]. a flush has no blocks.
+// returns the request's head descriptor, for disk.info[].
+// caller must hold vdisk_lock.
+static int
+submit(int type, uint blockno, uint64 *pa, int n)
+{
+  uint64 sector = (uint64)blockno * (BSIZE / 512);
+  int idx[NSEG+2];
+  struct virtq_desc *d[NSEG+2];
+  uint16 nxt[NSEG+2];
+  int i, head, ndesc;
+
+  if(n < 0 || n > NSEG)
+    panic("virtio submit");
+
+  // the spec's Section 5.2 says that legacy block operations use
+  // one descriptor for type/reserved/sector, then the data, then
+  // one for a 1-byte status result. the data may be split over
+  // several descriptors, one per buf here.
+  ndesc = disk.indirect ? 1 : n + 2;
+  while(alloc_descs(ndesc, idx) != 0){
+    // requests the device hasn't been told about yet
+    // can't complete and free their descriptors.
+    kick();
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
+  head = idx[0];
+
+  if(disk.indirect){
+    // the ring descriptor points at this request's own table.
+    disk.desc[head].addr = (uint64) disk.indirect_desc[head];
+    disk.desc[head].len = (n + 2) * sizeof(struct virtq_desc);
+    disk.desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[head].next = 0;
+    for(i = 0; i < n + 2; i++){
+      d[i] = &disk.indirect_desc[head][i];
+      nxt[i] = i + 1;
+    }
+  } else {
+    for(i = 0; i < n + 2; i++){
+      d[i] = &disk.desc[idx[i]];
+      nxt[i] = i + 1 < n + 2 ? idx[i+1] : 0;
+    }
+  }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[head];
 
-  if(write)
-    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
-  else
-    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->type = type;
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  d[0]->addr = (uint64) buf0;
+  d[0]->len = sizeof(struct virtio_blk_req);
+  d[0]->flags = VRING_DESC_F_NEXT;
+  d[0]->next = nxt[0];
+
+  for(i = 0; i < n; i++){
+    d[i+1]->addr = pa[i];
+    d[i+1]->len = BSIZE;
+    if(type == VIRTIO_BLK_T_OUT)
+      d[i+1]->flags = 0; // device reads the data
+    else
+      d[i+1]->flags = VRING_DESC_F_WRITE; // device writes the data
+    d[i+1]->flags |= VRING_DESC_F_NEXT;
+    d[i+1]->next = nxt[i+1];
+  }
+
+  disk.info[head].status = 0xff; // device writes 0 on success
+  d[n+1]->addr = (uint64) &disk.info[head].status;
+  d[n+1]->len = 1;
+  d[n+1]->flags = VRING_DESC_F_WRITE; // device writes the status
+  d[n+1]->next = 0;
+
+  disk.info[head].b = 0;
+  disk.info[head].done = 0;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % NUM] = head;
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
 
-  __sync_synchronize();
+  disk.unkicked += 1;
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  return head;
+}
+
+// submit a request for the n consecutive blocks in bufs[].
+// caller must hold vdisk_lock.
+static void
+submitbufs(int type, struct buf **bufs, int n)
+{
+  uint64 pa[NSEG];
+  int i, head;
+
+  if(n < 1 || n > NSEG)
+    panic("virtio submitbufs");
+  for(i = 0; i < n; i++){
+    if(bufs[i]->dev != bufs[0]->dev || bufs[i]->blockno != bufs[0]->blockno + i)
+      panic("virtio submit: not consecutive");
+    pa[i] = (uint64) bufs[i]->data;
+  }
+
+  head = submit(type, bufs[0]->blockno, pa, n);
+
+  // record the bufs for virtio_disk_intr(), which can't
+  // run until the caller releases vdisk_lock.
+  for(i = 0; i < n; i++){
+    bufs[i]->disk = 1;
+    bufs[i]->qnext = i + 1 < n ? bufs[i+1] : 0;
+  }
+  disk.info[head].b = bufs[0];
+}
+
+// queue a read or write of the n consecutive blocks in bufs[]
+// (at most NSEG) as a single disk request, and return without
+// waiting. the caller must hold the bufs' sleep-locks until
+// virtio_disk_wait() says each is done. nothing is sent to the
+// device until virtio_disk_kick(), so that a batch of requests
+// costs one notification.
+void
+virtio_disk_submit(struct buf **bufs, int n, int write)
+{
+  acquire(&disk.vdisk_lock);
+  submitbufs(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, bufs, n);
+  release(&disk.vdisk_lock);
+}
+
+// tell the device about everything submitted so far.
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  kick();
+  release(&disk.vdisk_lock);
+}
+
+// wait for virtio_disk_intr() to say b's request has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1)
+    sleep(b, &disk.vdisk_lock);
+  release(&disk.vdisk_lock);
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+
+  submitbufs(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, &b, 1);
+  kick();
 
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// read or write the n (at most NSEG) consecutive blocks starting
+// at blockno straight from or to memory, block i at physical
+// address pa[i], bypassing the buffer cache, and wait.
+void
+virtio_disk_direct(uint blockno, uint64 *pa, int n, int write)
+{
+  int head, done;
+
+  if(n < 1)
+    panic("virtio_disk_direct");
+
+  acquire(&disk.vdisk_lock);
+
+  done = 0;
+  head = submit(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, blockno, pa, n);
+  disk.info[head].done = &done;
+  kick();
+  while(done == 0)
+    sleep(&done, &disk.vdisk_lock);
+
+  release(&disk.vdisk_lock);
+}
+
+// make every write that has completed so far durable, and wait.
+// a no-op if the device has no write cache to flush.
+void
+virtio_disk_flush(void)
+{
+  uint64 n;
+
+  if(!disk.flush)
+    return;
+
+  acquire(&disk.vdisk_lock);
+
+  // flushes carry no buf to wait on, so count them instead.
+  // a flush that completes covers every write that completed
+  // before any earlier flush was submitted, so it's enough
+  // that as many flushes have finished as have been started.
+  n = ++disk.nflush;
+  submit(VIRTIO_BLK_T_FLUSH, 0, 0, 0);
+  kick();
+  while(disk.nflushed < n)
+    sleep(&disk.nflushed, &disk.vdisk_lock);
 
   release(&disk.vdisk_lock);
 }
@@ -304,9 +469,30 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
+    // disk is done with every buf in the request.
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(disk.info[id].done){
+      // a direct transfer.
+      *disk.info[id].done = 1;
+      wakeup(disk.info[id].done);
+    } else if(b == 0){
+      // a flush.
+      disk.nflushed += 1;
+      wakeup(&disk.nflushed);
+    }
+    while(b){
+      struct buf *nb = b->qnext;
+      b->qnext = 0;
+      b->disk = 0;
+      wakeup(b);
+      b = nb;
+    }
+
+    // the waiters don't need the descriptors, so
+    // recycle them here rather than in each waiter.
+    disk.info[id].b = 0;
+    disk.info[id].done = 0;
+    free_chain(id);
 
     disk.used_idx += 1;
   }
@@ -340,6 +340,47 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Look up a user virtual address, return the physical
+// address it maps to, or 0 if it is not user memory, or
+// if write is set and it is not writable.
+uint64
+useraddr(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  if(write && (*pte & PTE_W) == 0)
+    return 0;
+  return PTE2PA(*pte) + (va & (PGSIZE-1));
+}
+
+// For the copy loops below, which go through consecutive user
+// pages: return the physical address of user page va0, given
+// *ppte, the PTE of the page before it (or 0 for the first).
+// The next page's PTE is the next entry in the same last-level
+// page table, unless va0 starts a new one, so only one page in
+// 512 needs a walk() from the root.
+static uint64
+nextuserpa(pagetable_t pagetable, uint64 va0, pte_t **ppte)
+{
+  pte_t *pte = *ppte;
+
+  if(va0 >= MAXVA)
+    return 0;
+  if(pte && PX(0, va0) != 0)
+    pte++;
+  else
+    pte = walk(pagetable, va0, 0);
+  *ppte = pte;
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  return PTE2PA(*pte);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -347,10 +388,11 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte = 0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = nextuserpa(pagetable, va0, &pte);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -372,10 +414,11 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte = 0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = nextuserpa(pagetable, va0, &pte);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -397,12 +440,13 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, va0, pa0, w;
+  pte_t *pte = 0;
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = nextuserpa(pagetable, va0, &pte);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -411,6 +455,22 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
     char *p = (char *) (pa0 + (srcva - va0));
     while(n > 0){
+      // a word at a time, once p is aligned, until
+      // a word has a zero byte in it.
+      if((uint64)p % sizeof(w) == 0 && n >= sizeof(w)){
+        w = *(uint64*)p;
+        if(((w - 0x0101010101010101UL) & ~w & 0x8080808080808080UL) == 0){
+          if((uint64)dst % sizeof(w) == 0)
+            *(uint64*)dst = w;
+          else
+            memmove(dst, &w, sizeof(w));
+          n -= sizeof(w);
+          max -= sizeof(w);
+          p += sizeof(w);
+          dst += sizeof(w);
+          continue;
+        }
+      }
       if(*p == '\0'){
         *dst = '\0';
         got_null = 1;
@@ -16,30 +16,41 @@
 #endif
 
 #define NINODES 200
+#define GROUPSIZE 1024  // min blocks per allocation group
+#define COPYSIZE (64*1024)  // bytes read from a host file at a time
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+// [ boot block | sb block | log | group 0 | group 1 | ... ]
+// where each group is
+// [ inode bit map | free bit map | inode blocks | data blocks ]
+
+// size the log to the file system, so that large writes
+// can go in few transactions, up to what one header describes.
+int nlog = (FSSIZE/16 < LOGSIZE ? FSSIZE/16 : LOGSIZE) + 1;
+int ngroups;
+int groupsize;  // Blocks per group
+int ipg;      // Inodes per group
+int ninodeblocks;  // Inode blocks per group
+int nmeta;    // Number of meta blocks (boot, sb, nlog, group bitmaps and inodes)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;    // the image, written to fsfd in one go at the end
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
 
-void balloc(int);
+void balloc(void);
+uint allocblock(void);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
+void wimage(void);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint inum, struct dirent *de);
 void die(const char *);
 
 // convert to intel byte order
@@ -71,7 +82,7 @@ main(int argc, char *argv[])
   int i, cc, fd;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[BSIZE];
+  static char buf[COPYSIZE];
   struct dinode din;
 
 
@@ -90,29 +101,45 @@ main(int argc, char *argv[])
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  // big file systems get bigger groups, up to what
+  // one bit map block describes.
+  groupsize = (FSSIZE - 2 - nlog + NGROUP - 1) / NGROUP;
+  if(groupsize < GROUPSIZE)
+    groupsize = GROUPSIZE;
+  assert(groupsize <= BPB);
+  ngroups = (FSSIZE - 2 - nlog + groupsize - 1) / groupsize;
+  assert(ngroups <= NGROUP);
+  ipg = (NINODES / ngroups + IPB - 1) / IPB * IPB;
+  assert(ipg <= BPB);
+  ninodeblocks = ipg / IPB;
+  // the last group must have room for its metadata and some data
+  assert((FSSIZE - 2 - nlog) % groupsize == 0 ||
+         (FSSIZE - 2 - nlog) % groupsize > 2 + ninodeblocks);
+  nmeta = 2 + nlog + ngroups * (2 + ninodeblocks);
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
   sb.size = xint(FSSIZE);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ngroups * ipg);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.groupstart = xint(2+nlog);
+  sb.ngroups = xint(ngroups);
+  sb.groupsize = xint(groupsize);
+  sb.ipg = xint(ipg);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u, %d groups of %u blocks with %u inode blocks, 2 bitmap blocks) blocks %d total %d\n",
+         nmeta, nlog, ngroups, groupsize, ninodeblocks, nblocks, FSSIZE);
 
-  freeblock = nmeta;     // the first free block that we can allocate
+  freeblock = 2 + nlog;  // allocblock() skips group metadata
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // build the image in memory; calloc() zeroes it.
+  img = calloc(FSSIZE, BSIZE);
+  if(img == 0)
+    die("calloc");
 
-  memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(img + BSIZE, &sb, sizeof(sb));
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -152,7 +179,7 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirappend(rootino, &de);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,25 +187,45 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
+  // fix size of root inode dir, unless it is hashed
   rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(xshort(din.major) == 0){
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
+
+  balloc();
 
-  balloc(freeblock);
+  wimage();
 
   exit(0);
 }
 
+// Write the whole image out, in as few write()s as the host allows.
+void
+wimage(void)
+{
+  char *p = img;
+  long n = (long)FSSIZE * BSIZE;
+  long cc;
+
+  while(n > 0){
+    if((cc = write(fsfd, p, n)) <= 0)
+      die("write");
+    p += cc;
+    n -= cc;
+  }
+  if(close(fsfd) < 0)
+    die("close");
+}
+
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(write(fsfd, buf, BSIZE) != BSIZE)
-    die("write");
+  assert(sec < FSSIZE);
+  memmove(img + (long)sec * BSIZE, buf, BSIZE);
 }
 
 void
@@ -211,10 +258,8 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(read(fsfd, buf, BSIZE) != BSIZE)
-    die("read");
+  assert(sec < FSSIZE);
+  memmove(buf, img + (long)sec * BSIZE, BSIZE);
 }
 
 uint
@@ -231,32 +276,102 @@ ialloc(ushort type)
   return inum;
 }
 
+// Return the next free data block, skipping group metadata.
+uint
+allocblock(void)
+{
+  uint g, data;
+
+  g = BGROUP(freeblock, sb);
+  data = GSTART(g, sb) + 2 + ninodeblocks;
+  if(freeblock < data)
+    freeblock = data;
+  assert(freeblock < FSSIZE);
+  return freeblock++;
+}
+
+// Write each group's bit maps: its metadata, the blocks
+// below freeblock, and the inodes below freeinode are in use.
 void
-balloc(int used)
+balloc(void)
 {
   uchar buf[BSIZE];
-  int i;
+  uint g, i, start;
+
+  printf("balloc: first %d blocks have been allocated\n", freeblock);
+  for(g = 0; g < ngroups; g++){
+    start = GSTART(g, sb);
 
-  printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB; i++){
+      if(i < 2 + ninodeblocks || start + i < freeblock || start + i >= FSSIZE)
+        buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    wsect(start + 1, buf);
+
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB; i++){
+      if(i >= ipg || g * ipg + i < freeinode)
+        buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    wsect(IBMAP(g, sb), buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  printf("balloc: wrote bitmaps of %d groups\n", ngroups);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding file block fbn of din,
+// allocating it if necessary.
+uint
+fbnaddr(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint x, y;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(allocblock());
+    }
+    x = xint(din->addrs[fbn]);
+  } else if(fbn < NDIRECT + NINDIRECT){
+    if(xint(din->addrs[NDIRECT]) == 0){
+      din->addrs[NDIRECT] = xint(allocblock());
+    }
+    rsect(xint(din->addrs[NDIRECT]), (char*)indirect);
+    if(indirect[fbn - NDIRECT] == 0){
+      indirect[fbn - NDIRECT] = xint(allocblock());
+      wsect(xint(din->addrs[NDIRECT]), (char*)indirect);
+    }
+    x = xint(indirect[fbn-NDIRECT]);
+  } else {
+    y = fbn - NDIRECT - NINDIRECT;
+    if(xint(din->addrs[NDIRECT+1]) == 0){
+      din->addrs[NDIRECT+1] = xint(allocblock());
+    }
+    rsect(xint(din->addrs[NDIRECT+1]), (char*)indirect);
+    if(indirect[y / NINDIRECT] == 0){
+      indirect[y / NINDIRECT] = xint(allocblock());
+      wsect(xint(din->addrs[NDIRECT+1]), (char*)indirect);
+    }
+    x = xint(indirect[y / NINDIRECT]);
+    rsect(x, (char*)indirect);
+    if(indirect[y % NINDIRECT] == 0){
+      indirect[y % NINDIRECT] = xint(allocblock());
+      wsect(x, (char*)indirect);
+    }
+    x = xint(indirect[y % NINDIRECT]);
+  }
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -264,27 +379,11 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = fbnaddr(&din, fbn);
+    assert(x < FSSIZE);
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    // straight into the image, no read-modify-write
+    bcopy(p, img + (long)x * BSIZE + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
@@ -293,6 +392,63 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Same as namehash() in kernel/fs.c.
+uint
+namehash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Add de to directory inum, switching to hash buckets
+// once the first block is full, like dirlink() in kernel/fs.c.
+void
+dirappend(uint inum, struct dirent *de)
+{
+  struct dinode din;
+  struct dirent bucket[DPB];
+  struct dirhead *dh;
+  uint bn, x, next;
+  int j;
+
+  rinode(inum, &din);
+  if(xshort(din.major) == 0 && xint(din.size) < BSIZE){
+    iappend(inum, de, sizeof(*de));
+    return;
+  }
+  if(xshort(din.major) == 0){
+    din.major = xshort(NDIRBUCKET);
+    din.size = xint((1 + NDIRBUCKET) * BSIZE);
+  }
+  bn = 1 + namehash(de->name) % xshort(din.major);
+  for(;;){
+    x = fbnaddr(&din, bn);
+    winode(inum, &din);
+    rsect(x, (char*)bucket);
+    for(j = 1; j < DPB; j++){
+      if(bucket[j].inum == 0){
+        bucket[j] = *de;
+        wsect(x, (char*)bucket);
+        return;
+      }
+    }
+    dh = (struct dirhead*)bucket;
+    if((next = xint(dh->next)) == 0){
+      // the bucket is full: chain on a new last block.
+      next = xint(din.size) / BSIZE;
+      dh->next = xint(next);
+      wsect(x, (char*)bucket);
+      din.size = xint(xint(din.size) + BSIZE);
+    }
+    bn = next;
+  }
+}
+
 void
 die(const char *s)
 {
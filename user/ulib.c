@@ -3,6 +3,11 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// memset, memmove and memcmp go a word at a time once the
+// pointers are word-aligned, like those in kernel/string.c.
+#define WSIZE sizeof(uint64)
+#define WMASK (WSIZE - 1)
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -36,10 +41,28 @@ void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && ((uint64)cdst & WMASK)){
+    *cdst++ = c;
+    n--;
   }
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (uint64 *) cdst;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
+  }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -100,15 +123,58 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  uint64 *wdst;
+  const uint64 *wsrc;
+  int aligned;
 
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
+  aligned = (((uint64)src ^ (uint64)dst) & WMASK) == 0;
   if (src > dst) {
+    if(aligned){
+      while(n > 0 && ((uint64)dst & WMASK)){
+        *dst++ = *src++;
+        n--;
+      }
+      wdst = (uint64 *) dst;
+      wsrc = (const uint64 *) src;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4, wsrc += 4){
+        wdst[0] = wsrc[0];
+        wdst[1] = wsrc[1];
+        wdst[2] = wsrc[2];
+        wdst[3] = wsrc[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wdst++ = *wsrc++;
+      dst = (char *) wdst;
+      src = (const char *) wsrc;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(aligned){
+      while(n > 0 && ((uint64)dst & WMASK)){
+        *--dst = *--src;
+        n--;
+      }
+      wdst = (uint64 *) dst;
+      wsrc = (const uint64 *) src;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        wdst -= 4, wsrc -= 4;
+        wdst[3] = wsrc[3];
+        wdst[2] = wsrc[2];
+        wdst[1] = wsrc[1];
+        wdst[0] = wsrc[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wdst = *--wsrc;
+      dst = (char *) wdst;
+      src = (const char *) wsrc;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -119,6 +185,16 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if((((uint64)p1 ^ (uint64)p2) & WMASK) == 0){
+    while(n > 0 && ((uint64)p1 & WMASK)){
+      if(*p1 != *p2)
+        return *p1 - *p2;
+      p1++, p2++, n--;
+    }
+    // skip equal words; the bytes below find the difference.
+    while(n >= WSIZE && *(uint64*)p1 == *(uint64*)p2)
+      p1 += WSIZE, p2 += WSIZE, n -= WSIZE;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
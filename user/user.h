@@ -1,6 +1,8 @@
 struct stat;
 struct rtcdate;
 struct pstat;
+struct logstat;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -26,6 +28,13 @@ int sleep(int);
 int uptime(void);
 int nice(int);                  //declare nice system call on user side
 int getpstat(struct pstat*);    //declare getpstat system call on user side
+int getlogstat(struct logstat*);
+int fsync(int);
+int pread(int, void*, int, uint);
+int pwrite(int, const void*, int, uint);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int splice(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
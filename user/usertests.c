@@ -4,6 +4,7 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/iovec.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -335,6 +336,226 @@ truncate1(char *s)
   close(fd3);
 }
 
+// pread() and pwrite() go to the given offset
+// and leave the file offset alone.
+void
+preadwrite(char *s)
+{
+  char buf[8];
+  int fd, n;
+
+  unlink("pwfile");
+  fd = open("pwfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create pwfile failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "abcdefgh", 8) != 8){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 2) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  n = pread(fd, buf, sizeof(buf), 1);
+  if(n != 7 || memcmp(buf, "bXYefgh", 7) != 0){
+    printf("%s: pread got %d bytes\n", s, n);
+    exit(1);
+  }
+  // the offset is still at the end of the first write.
+  if(write(fd, "ij", 2) != 2){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, sizeof(buf), 8) != 2 || buf[0] != 'i'){
+    printf("%s: offset moved\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pwfile");
+}
+
+// writev() writes the buffers back to back,
+// and readv() fills them in order.
+void
+readvwritev(char *s)
+{
+  struct iovec iov[3];
+  char a[4], b[8];
+  int fd, n;
+
+  unlink("iovfile");
+  fd = open("iovfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iovfile failed\n", s);
+    exit(1);
+  }
+  iov[0].base = "head";
+  iov[0].len = 4;
+  iov[1].base = "";
+  iov[1].len = 0;
+  iov[2].base = "payload!";
+  iov[2].len = 8;
+  if(writev(fd, iov, 3) != 12){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iovfile", O_RDONLY);
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  n = readv(fd, iov, 2);
+  if(n != 12 || memcmp(a, "head", 4) != 0 || memcmp(b, "payload!", 8) != 0){
+    printf("%s: readv got %d bytes\n", s, n);
+    exit(1);
+  }
+  if(readv(fd, iov, 2) != 0){
+    printf("%s: readv past end\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iovfile");
+}
+
+// splice() a file into a pipe in one process and
+// out of the pipe into another file in another.
+void
+splicetest(char *s)
+{
+  enum { N = 3*BSIZE + 123 };
+  static char buf[N];
+  int fd, fds[2], pid, i, n, xstatus;
+
+  for(i = 0; i < N; i++)
+    buf[i] = i % 251;
+  unlink("splicein");
+  unlink("spliceout");
+  fd = open("splicein", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: write splicein failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splicein", O_RDONLY);
+    // asks for more than there is: stops at end of file.
+    if(splice(fd, fds[1], N + 100) != N){
+      printf("%s: splice into pipe failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  fd = open("spliceout", O_CREATE|O_RDWR);
+  for(i = 0; i < N; i += n){
+    if((n = splice(fds[0], fd, N - i)) <= 0){
+      printf("%s: splice out of pipe failed\n", s);
+      exit(1);
+    }
+  }
+  if(splice(fds[0], fd, 1) != 0){
+    printf("%s: splice past end of pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  close(fd);
+
+  memset(buf, 0, N);
+  fd = open("spliceout", O_RDONLY);
+  if(read(fd, buf, N) != N){
+    printf("%s: read spliceout failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("splicein");
+  unlink("spliceout");
+}
+
+// check memset, memmove and memcmp at assorted alignments
+// and overlaps, then time them on big buffers.
+void
+memops(char *s)
+{
+  enum { N = 256, BIG = 64*1024, ROUNDS = 200 };
+  static char a[N+16], b[N+16], big1[BIG], big2[BIG];
+  int i, k, so, doff, n, t0, t1, t2;
+
+  for(so = 0; so < 8; so++){
+    for(doff = 0; doff < 8; doff++){
+      for(n = 0; n < N; n += 37){
+        for(i = 0; i < N+16; i++){
+          a[i] = i;
+          b[i] = i;
+        }
+        memmove(a + doff, a + so, n);
+        for(i = 0; i < n; i++){
+          if(a[doff+i] != (char)(so+i)){
+            printf("%s: memmove %d->%d n %d wrong at %d\n", s, so, doff, n, i);
+            exit(1);
+          }
+        }
+        memset(b + so, 0x5a, n);
+        for(i = 0; i < N+16; i++){
+          if(b[i] != (i >= so && i < so+n ? 0x5a : (char)i)){
+            printf("%s: memset at %d n %d wrong at %d\n", s, so, n, i);
+            exit(1);
+          }
+        }
+        memmove(b + doff, a + so, n);
+        if(memcmp(b + doff, a + so, n) != 0){
+          printf("%s: memcmp equal %d %d %d\n", s, so, doff, n);
+          exit(1);
+        }
+        if(n > 0){
+          b[doff + n - 1] ^= 1;
+          if(memcmp(b + doff, a + so, n) == 0){
+            printf("%s: memcmp differ %d %d %d\n", s, so, doff, n);
+            exit(1);
+          }
+        }
+      }
+    }
+  }
+
+  t0 = uptime();
+  for(k = 0; k < ROUNDS; k++)
+    memset(big1, k, BIG);
+  t1 = uptime();
+  for(k = 0; k < ROUNDS; k++)
+    memmove(big2, big1, BIG);
+  t2 = uptime();
+  if(memcmp(big1, big2, BIG) != 0){
+    printf("%s: big memmove wrong\n", s);
+    exit(1);
+  }
+  printf("memops: %d x %d bytes: memset %d ticks, memmove %d ticks\n",
+         ROUNDS, BIG, t1 - t0, t2 - t1);
+}
+
 // write to an open FD whose file has just been truncated.
 // this causes a write at an offset beyond the end of the file.
 // such writes fail on xv6 (unlike POSIX) but at least
@@ -569,6 +790,10 @@ writetest(char *s)
   }
 }
 
+// big enough to need the doubly-indirect block,
+// but a whole MAXFILE would not fit on the disk.
+#define BIGFILE (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -580,7 +805,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGFILE; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -600,7 +825,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGFILE){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -1553,6 +1778,160 @@ bigdir(char *s)
   }
 }
 
+// hashed directory with more names than its first block
+// and all of its buckets can hold, so buckets get chained.
+void
+hashdir(char *s)
+{
+  enum { N = (DPB-2) + NDIRBUCKET*(DPB-1) + 2*DPB };
+  int i, j, fd;
+  char name[12];
+  struct stat st;
+
+  unlink("hd/f");
+  unlink("hd");
+  if(mkdir("hd") != 0 || (fd = open("hd/f", O_CREATE)) < 0){
+    printf("%s: hashdir create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memmove(name, "hd/", 3);
+  for(i = 0; i < N; i++){
+    j = i;
+    name[3] = 'x';
+    name[4] = 'a' + j % 26; j /= 26;
+    name[5] = 'a' + j % 26; j /= 26;
+    name[6] = 'a' + j % 26;
+    name[7] = '\0';
+    if(link("hd/f", name) != 0){
+      printf("%s: hashdir link(%s) failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  // every bucket is allocated, and some have overflowed.
+  if((fd = open("hd", O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    printf("%s: hashdir stat failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(st.size <= (1 + NDIRBUCKET) * BSIZE){
+    printf("%s: hashdir no overflow, size %d\n", s, (int)st.size);
+    exit(1);
+  }
+
+  // creating still works in a full directory.
+  if(mkdir("hd/dd") != 0 || (fd = open("hd/dd/ff", O_CREATE)) < 0){
+    printf("%s: hashdir create in full dir failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("hd/dd/ff") != 0 || unlink("hd/dd") != 0){
+    printf("%s: hashdir unlink dd failed\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    j = i;
+    name[4] = 'a' + j % 26; j /= 26;
+    name[5] = 'a' + j % 26; j /= 26;
+    name[6] = 'a' + j % 26;
+    if(unlink(name) != 0){
+      printf("%s: hashdir unlink(%s) failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd/f") != 0 || unlink("hd") != 0){
+    printf("%s: hashdir not empty\n", s);
+    exit(1);
+  }
+}
+
+// entries in newly allocated hash buckets are still there
+// once the directory's i-node has left the in-memory table.
+void
+hashdirevict(char *s)
+{
+  enum { N = 4*DPB, NEVICT = 120 };
+  int i, fd, n;
+  char name[12];
+  struct dirent de;
+
+  unlink("he/f");
+  unlink("he");
+  if(mkdir("he") != 0 || (fd = open("he/f", O_CREATE)) < 0){
+    printf("%s: hashdirevict create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  memmove(name, "he/", 3);
+  for(i = 0; i < N; i++){
+    name[3] = 'x';
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    name[7] = '\0';
+    if(link("he/f", name) != 0){
+      printf("%s: hashdirevict link(%s) failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  // use more other i-nodes than the table is likely to hold.
+  name[0] = 'e';
+  name[1] = 'v';
+  for(i = 0; i < NEVICT; i++){
+    name[2] = '0' + i / 100;
+    name[3] = '0' + i / 10 % 10;
+    name[4] = '0' + i % 10;
+    name[5] = '\0';
+    if((fd = open(name, O_CREATE)) < 0){
+      printf("%s: hashdirevict create(%s) failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < NEVICT; i++){
+    name[2] = '0' + i / 100;
+    name[3] = '0' + i / 10 % 10;
+    name[4] = '0' + i % 10;
+    unlink(name);
+  }
+
+  // f and its N links, plus "." and "..".
+  if((fd = open("he", O_RDONLY)) < 0){
+    printf("%s: hashdirevict open failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != N + 3){
+    printf("%s: hashdirevict %d entries, expected %d\n", s, n, N + 3);
+    exit(1);
+  }
+
+  memmove(name, "he/", 3);
+  for(i = 0; i < N; i++){
+    name[3] = 'x';
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    name[7] = '\0';
+    if(unlink(name) != 0){
+      printf("%s: hashdirevict unlink(%s) failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("he/f") != 0 || unlink("he") != 0){
+    printf("%s: hashdirevict not empty\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -2828,6 +3207,10 @@ main(int argc, char *argv[])
     {copyinstr3, "copyinstr3"},
     {rwsbrk, "rwsbrk" },
     {truncate1, "truncate1"},
+    {preadwrite, "preadwrite"},
+    {readvwritev, "readvwritev"},
+    {splicetest, "splicetest"},
+    {memops, "memops"},
     {truncate2, "truncate2"},
     {truncate3, "truncate3"},
     {reparent2, "reparent2"},
@@ -2881,6 +3264,8 @@ main(int argc, char *argv[])
     {iref, "iref"},
     {forktest, "forktest"},
     {bigdir, "bigdir"}, // slow
+    {hashdir, "hashdir"}, // slow
+    {hashdirevict, "hashdirevict"},
     { 0, 0},
   };
 
@@ -38,3 +38,10 @@ entry("sleep");
 entry("uptime");
 entry("nice");
 entry("getpstat");
+entry("getlogstat");
+entry("fsync");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("splice");